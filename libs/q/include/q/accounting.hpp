@@ -0,0 +1,139 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_ACCOUNTING_HPP
+#define LIBQ_ACCOUNTING_HPP
+
+#include <q/types.hpp>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace q {
+
+/**
+ * The number of live objects of some kind, and their approximate size in
+ * bytes. The size is the size of the objects themselves, not of what they
+ * refer to, such as data captured by heap allocated functions.
+ */
+struct object_count
+{
+	std::size_t count;
+	std::size_t bytes;
+};
+
+/**
+ * The tasks waiting in a queue.
+ */
+struct queue_accounting
+{
+	priority_t priority;
+	object_count tasks;
+};
+
+/**
+ * A snapshot of the live objects held by q, to find out what is using memory
+ * when it grows, e.g. promise chains which are never settled.
+ *
+ * Everything is accounted only if object accounting is enabled when it's
+ * created: queues (with the tasks in them), defers (the shared state behind
+ * a promise, counted until it's destroyed, which may be long after it's
+ * settled), continuations waiting for a promise to be settled, and elements
+ * buffered in channels. The tasks in a single queue are always available
+ * through queue::accounting( ).
+ */
+struct object_accounting
+{
+	bool enabled;
+
+	object_count defers;
+	object_count continuations;
+	object_count channel_elements;
+
+	// The sum of the tasks in all queues
+	object_count queued_tasks;
+	std::vector< queue_accounting > queues;
+};
+
+/**
+ * Enables or disables object accounting. It's cheap (per-thread counters),
+ * but not free, so it's disabled by default.
+ *
+ * Objects are accounted for if accounting is enabled when they are created,
+ * so it should be enabled at startup to get the full picture.
+ */
+void set_object_accounting( bool enabled );
+
+Q_NODISCARD
+bool is_object_accounting_enabled( ) noexcept;
+
+/**
+ * Returns a snapshot of the live objects, summed over all threads.
+ */
+object_accounting get_object_accounting( );
+
+std::ostream& operator<<( std::ostream& os, const object_accounting& );
+
+namespace detail {
+
+enum class accounted_object
+{
+	defer = 0,
+	continuation = 1,
+	channel_element = 2
+};
+
+void account_objects(
+	accounted_object kind, std::int64_t count, std::int64_t bytes )
+noexcept;
+
+std::vector< queue_accounting > get_queue_accounting( );
+
+/**
+ * Accounts for one object of size bytes, for the lifetime of this object, if
+ * object accounting is enabled when it is constructed.
+ */
+template< accounted_object Kind >
+class accounted
+{
+public:
+	explicit accounted( std::size_t bytes ) noexcept
+	: bytes_( is_object_accounting_enabled( ) ? bytes : 0 )
+	{
+		if ( bytes_ )
+			account_objects( Kind, 1, bytes_ );
+	}
+
+	accounted( const accounted& ) = delete;
+	accounted& operator=( const accounted& ) = delete;
+
+	~accounted( )
+	{
+		if ( bytes_ )
+			account_objects(
+				Kind, -1, -static_cast< std::int64_t >( bytes_ ) );
+	}
+
+private:
+	std::size_t bytes_;
+};
+
+} // namespace detail
+
+} // namespace q
+
+#endif // LIBQ_ACCOUNTING_HPP
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_AS_COMPLETED_HPP
+#define LIBQ_AS_COMPLETED_HPP
+
+#include <q/channel.hpp>
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace q {
+
+namespace detail {
+
+template< typename List >
+struct as_completed_element
+{
+	typedef typename detail::all_element<
+		typename std::decay< List >::type::value_type::tuple_type
+	>::element_type type;
+};
+
+/**
+ * Writes the results of q::as_completed( ) as they settle, and closes the
+ * channel after the last one.
+ */
+template< typename Tuple >
+class as_completed_state
+{
+public:
+	typedef all_element< Tuple >                            element;
+	typedef typename element::element_type                  element_type;
+	typedef writable< std::size_t, expect< element_type > > writable_type;
+
+	as_completed_state( writable_type&& writable, std::size_t num )
+	: writable_( std::move( writable ) )
+	, remaining_( num )
+	{ }
+
+	void settle( std::size_t index, expect< Tuple >&& exp )
+	{
+		// A closed channel means no one is reading anymore, so the
+		// result is just dropped
+		ignore_result( writable_.write(
+			index, element::make_expect( std::move( exp ) ) ) );
+
+		if ( remaining_.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+			writable_.close( );
+	}
+
+private:
+	writable_type writable_;
+	std::atomic< std::size_t > remaining_;
+};
+
+} // namespace detail
+
+/**
+ * Streams the results of a list of promises in the order they settle, rather
+ * than in the order of the list. Every value is written to the returned
+ * readable as soon as its promise is settled, together with its index in the
+ * list, as a q::expect of the value (of the same type as for q::all( )). The
+ * readable is closed when all promises have settled.
+ *
+ * The promises are already running, so they can't be paused; instead, the
+ * channel's should_write( ) and buffer count tell how far behind the reader
+ * is. By default, the channel can buffer all results.
+ */
+template< typename List >
+typename std::enable_if<
+	is_vector< typename std::decay< List >::type >::value &&
+	is_promise< typename std::decay< List >::type::value_type >::value,
+	readable<
+		std::size_t,
+		expect< typename detail::as_completed_element< List >::type >
+	>
+>::type
+as_completed( List&& list, const queue_ptr& queue, std::size_t buffer_count )
+{
+	typedef typename std::decay< List >::type::value_type::tuple_type
+		tuple_type;
+	typedef typename detail::as_completed_element< List >::type
+		element_type;
+	typedef detail::as_completed_state< tuple_type > state_type;
+
+	channel< std::size_t, expect< element_type > > ch( queue, buffer_count );
+
+	if ( list.empty( ) )
+	{
+		ch.get_writable( ).close( );
+		return ch.get_readable( );
+	}
+
+	auto state = ::q::make_shared< state_type >(
+		ch.get_writable( ), list.size( ) );
+
+	for ( std::size_t i = 0; i < list.size( ); ++i )
+		list[ i ].on_settled( [ state, i ]( expect< tuple_type >&& exp )
+		{
+			state->settle( i, std::move( exp ) );
+		} );
+
+	return ch.get_readable( );
+}
+
+template< typename List >
+typename std::enable_if<
+	is_vector< typename std::decay< List >::type >::value &&
+	is_promise< typename std::decay< List >::type::value_type >::value,
+	readable<
+		std::size_t,
+		expect< typename detail::as_completed_element< List >::type >
+	>
+>::type
+as_completed( List&& list, const queue_ptr& queue )
+{
+	auto buffer_count = std::max< std::size_t >( list.size( ), 1 );
+
+	return as_completed( std::forward< List >( list ), queue, buffer_count );
+}
+
+} // namespace q
+
+#endif // LIBQ_AS_COMPLETED_HPP
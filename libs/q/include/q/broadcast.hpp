@@ -0,0 +1,684 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_BROADCAST_HPP
+#define LIBQ_BROADCAST_HPP
+
+#include <q/channel.hpp>
+
+#include <deque>
+#include <list>
+#include <cstdint>
+
+namespace q {
+
+/**
+ * Thrown (as a rejection) to a broadcast reader which fell too far behind and
+ * was dropped, when the broadcast_overflow::drop_slow_readers policy is used.
+ */
+Q_MAKE_CONDITION_EXCEPTION( broadcast_lagged_exception );
+
+/**
+ * What to do when the slowest reader of a broadcast channel is buffer_count
+ * elements behind the writer.
+ *
+ * backpressure:      Pause the writer (should_write( ) returns false) until
+ *                    the slowest reader catches up.
+ * drop_slow_readers: Drop the readers which are the furthest behind. Their
+ *                    next read will be rejected with broadcast_lagged_exception.
+ */
+enum class broadcast_overflow
+{
+	backpressure,
+	drop_slow_readers,
+};
+
+template< typename... T >
+class broadcast_readable;
+
+template< typename... T >
+class broadcast_writable;
+
+template< typename... T >
+class broadcast_channel;
+
+namespace detail {
+
+/**
+ * The shared state of a broadcast channel. Every written element is stored
+ * once, and each reader has its own cursor (sequence number) into the buffer.
+ * Elements are released when the slowest reader has passed them.
+ */
+template< typename... T >
+class shared_broadcast
+: public std::enable_shared_from_this< shared_broadcast< T... > >
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+	typedef std::shared_ptr< const tuple_type > element_type;
+	typedef detail::defer< element_type > defer_type;
+
+	struct cursor
+	{
+		cursor( std::uint64_t position )
+		: position( position )
+		, dropped( false )
+		{ }
+
+		std::uint64_t position;
+		bool dropped;
+		std::shared_ptr< defer_type > waiter;
+	};
+
+	typedef std::shared_ptr< cursor > cursor_ptr;
+
+	shared_broadcast(
+		const queue_ptr& queue,
+		std::size_t buffer_count,
+		std::size_t resume_count,
+		broadcast_overflow overflow
+	)
+	: default_queue_( queue )
+	, mutex_( Q_HERE, "broadcast" )
+	, close_exception_( std::make_tuple( false, std::exception_ptr( ) ) )
+	, closed_( false )
+	, paused_( false )
+	, base_( 0 )
+	, buffer_count_( std::max< std::size_t >( buffer_count, 1 ) )
+	, resume_count_( std::min( resume_count, buffer_count_ ) )
+	, overflow_( overflow )
+	{ }
+
+	/**
+	 * Adds a reader, which will get all elements written from now on.
+	 */
+	cursor_ptr subscribe( )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		auto c = q::make_shared< cursor >( end( ) );
+		cursors_.push_back( c );
+
+		return c;
+	}
+
+	void unsubscribe( const cursor_ptr& c )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		cursors_.remove( c );
+
+		trim( );
+	}
+
+	Q_NODISCARD
+	promise< element_type > read( const cursor_ptr& c )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( c->dropped )
+			return reject< element_type >(
+				default_queue_,
+				static_exception_ptr< broadcast_lagged_exception >( ) );
+
+		if ( c->position < end( ) )
+		{
+			element_type elem = ring_[ c->position - base_ ];
+			++c->position;
+
+			trim( );
+
+			return q::with( default_queue_, std::move( elem ) );
+		}
+
+		if ( closed_ )
+			return reject< element_type >(
+				default_queue_, get_close_exception( ) );
+
+		auto defer = ::q::make_shared< defer_type >( default_queue_ );
+		c->waiter = defer;
+
+		return defer->get_promise( );
+	}
+
+	Q_NODISCARD
+	bool write( tuple_type&& t )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( closed_ )
+			return false;
+
+		std::shared_ptr< const tuple_type > elem =
+			q::make_shared< tuple_type >( std::move( t ) );
+		const std::uint64_t position = end( );
+
+		ring_.push_back( elem );
+
+		for ( auto& c : cursors_ )
+		{
+			if ( !c->waiter || c->position != position )
+				continue;
+
+			auto waiter = std::move( c->waiter );
+			c->waiter.reset( );
+			++c->position;
+
+			waiter->set_value( std::make_tuple( elem ) );
+		}
+
+		trim( );
+
+		if ( ring_.size( ) >= buffer_count_ )
+		{
+			if ( overflow_ == broadcast_overflow::backpressure )
+				paused_ = true;
+			else
+				drop_slow_readers( );
+		}
+
+		return true;
+	}
+
+	Q_NODISCARD
+	bool should_write( ) const
+	{
+		return !paused_ && !closed_;
+	}
+
+	Q_NODISCARD
+	bool is_closed( ) const
+	{
+		return closed_;
+	}
+
+	/**
+	 * The number of elements currently buffered for the slowest reader.
+	 */
+	Q_NODISCARD
+	std::size_t size( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return ring_.size( );
+	}
+
+	Q_NODISCARD
+	std::size_t readers( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return cursors_.size( );
+	}
+
+	void set_resume_notification( shared_task fn, bool trigger_now )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			resume_notification_ = fn;
+
+			if ( trigger_now && !should_write( ) )
+				notification = resume_notification_;
+		}
+
+		if ( notification )
+			default_queue_->push( std::move( notification ) );
+	}
+
+	void close( std::tuple< bool, std::exception_ptr > tup )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closed_.exchange( true ) )
+				return;
+
+			close_exception_ = std::move( tup );
+
+			for ( auto& c : cursors_ )
+			{
+				if ( !c->waiter )
+					continue;
+
+				auto waiter = std::move( c->waiter );
+				c->waiter.reset( );
+
+				waiter->set_exception( get_close_exception( ) );
+			}
+
+			notification = resume_notification_;
+		}
+
+		if ( notification )
+			notification( );
+	}
+
+	Q_NODISCARD
+	const queue_ptr& get_queue( ) const
+	{
+		return default_queue_;
+	}
+
+private:
+	std::uint64_t end( ) const
+	{
+		return base_ + ring_.size( );
+	}
+
+	std::exception_ptr get_close_exception( ) const
+	{
+		return std::get< 0 >( close_exception_ )
+			? std::get< 1 >( close_exception_ )
+			: static_exception_ptr< channel_closed_exception >( );
+	}
+
+	/**
+	 * Releases the elements all readers have passed, and resumes the
+	 * writer if enough elements have been released.
+	 */
+	void trim( )
+	{
+		std::uint64_t lowest = end( );
+
+		for ( auto& c : cursors_ )
+			lowest = std::min( lowest, c->position );
+
+		while ( base_ < lowest )
+		{
+			ring_.pop_front( );
+			++base_;
+		}
+
+		if ( ring_.size( ) < resume_count_ && paused_.exchange( false ) )
+		{
+			shared_task notification = resume_notification_;
+			if ( notification )
+				default_queue_->push( std::move( notification ) );
+		}
+	}
+
+	void drop_slow_readers( )
+	{
+		while ( ring_.size( ) >= buffer_count_ && !cursors_.empty( ) )
+		{
+			const std::uint64_t lowest = base_;
+
+			cursors_.remove_if( [ lowest ]( const cursor_ptr& c )
+			{
+				if ( c->position != lowest )
+					return false;
+
+				c->dropped = true;
+				return true;
+			} );
+
+			trim( );
+		}
+	}
+
+	queue_ptr default_queue_;
+	mutable mutex mutex_;
+	std::deque< element_type > ring_;
+	std::list< cursor_ptr > cursors_;
+	// True if arbitrary exception, false if "closed exception"
+	std::tuple< bool, std::exception_ptr > close_exception_;
+	std::atomic< bool > closed_;
+	std::atomic< bool > paused_;
+	// The sequence number of the first element in ring_
+	std::uint64_t base_;
+	const std::size_t buffer_count_;
+	const std::size_t resume_count_;
+	const broadcast_overflow overflow_;
+	shared_task resume_notification_;
+};
+
+template< typename... T >
+class broadcast_subscription
+{
+public:
+	typedef shared_broadcast< T... > shared_type;
+	typedef typename shared_type::cursor_ptr cursor_ptr;
+
+	broadcast_subscription( std::shared_ptr< shared_type > shared )
+	: shared_( std::move( shared ) )
+	, cursor_( shared_->subscribe( ) )
+	{ }
+
+	~broadcast_subscription( )
+	{
+		shared_->unsubscribe( cursor_ );
+	}
+
+	const cursor_ptr& get_cursor( ) const
+	{
+		return cursor_;
+	}
+
+private:
+	std::shared_ptr< shared_type > shared_;
+	cursor_ptr cursor_;
+};
+
+template< typename... T >
+class broadcast_owner
+{
+public:
+	broadcast_owner( std::shared_ptr< shared_broadcast< T... > > shared )
+	: shared_( std::move( shared ) )
+	{ }
+
+	~broadcast_owner( )
+	{
+		shared_->close(
+			std::make_tuple( false, std::exception_ptr( ) ) );
+	}
+
+private:
+	std::shared_ptr< shared_broadcast< T... > > shared_;
+};
+
+} // namespace detail
+
+/**
+ * A reader of a broadcast channel. Copies of a broadcast_readable share the
+ * same position in the stream. When the last copy is destructed, the reader
+ * is unsubscribed and no longer holds back the writer.
+ *
+ * Reads must not overlap, i.e. a new read must not be issued until the
+ * previous one has been resolved.
+ */
+template< typename... T >
+class broadcast_readable
+{
+public:
+	typedef detail::shared_broadcast< T... > shared_type;
+	typedef typename shared_type::element_type element_type;
+	typedef typename shared_type::tuple_type tuple_type;
+
+	broadcast_readable( ) = default;
+	broadcast_readable( const broadcast_readable& ) = default;
+	broadcast_readable( broadcast_readable&& ) = default;
+
+	broadcast_readable& operator=( const broadcast_readable& ) = default;
+	broadcast_readable& operator=( broadcast_readable&& ) = default;
+
+	/**
+	 * Reads the next element. The element is shared by all readers, and
+	 * must not be modified.
+	 */
+	Q_NODISCARD
+	promise< element_type > read( )
+	{
+		return shared_->read( subscription_->get_cursor( ) );
+	}
+
+	/**
+	 * Calls fn with every element (as const references) until the channel
+	 * is closed. fn can return a promise, in which case the next element
+	 * isn't read until this promise is resolved.
+	 */
+	template< typename Fn >
+	Q_NODISCARD
+	promise< > consume( Fn&& fn )
+	{
+		broadcast_readable< T... > self = *this;
+
+		auto _fn = decay_function( std::forward< Fn >( fn ) );
+
+		auto cb =
+			[ self, _fn ]
+			( resolver< > resolve, rejecter< > reject )
+			mutable
+		{
+			typedef function< promise< >( ) > recurser_type;
+			auto recurser = std::make_shared< recurser_type >( );
+
+			auto completer =
+				[ recurser, resolve ]
+				( const channel_closed_exception& )
+				mutable
+			{
+				( *recurser ) = recurser_type( );
+				resolve( );
+			};
+
+			auto failer =
+				[ recurser, reject ]
+				( std::exception_ptr err )
+				mutable
+			{
+				( *recurser ) = recurser_type( );
+				reject( std::move( err ) );
+			};
+
+			auto recurser_fn =
+				[ self, _fn, recurser, completer, failer ]
+				( )
+				mutable
+			{
+				return self.read( )
+				.then( [ _fn ]( element_type&& elem ) mutable
+				{
+					return call_with_const_args_by_tuple(
+						_fn, *elem );
+				} )
+				.then( [ recurser ]( )
+				{
+					return ( *recurser )( );
+				} )
+				.fail( completer )
+				.fail( failer );
+			};
+
+			*recurser = std::move( recurser_fn );
+
+			ignore_result( ( *recurser )( ) );
+		};
+
+		return q::make_promise( get_queue( ), std::move( cb ) );
+	}
+
+	Q_NODISCARD
+	bool is_closed( ) const
+	{
+		return shared_->is_closed( );
+	}
+
+	Q_NODISCARD
+	const queue_ptr& get_queue( ) const
+	{
+		return shared_->get_queue( );
+	}
+
+private:
+	broadcast_readable( std::shared_ptr< shared_type > shared )
+	: shared_( shared )
+	, subscription_(
+		q::make_shared< detail::broadcast_subscription< T... > >(
+			shared ) )
+	{ }
+
+	friend class broadcast_channel< T... >;
+
+	std::shared_ptr< shared_type > shared_;
+	std::shared_ptr< detail::broadcast_subscription< T... > > subscription_;
+};
+
+template< typename... T >
+class broadcast_writable
+{
+public:
+	typedef detail::shared_broadcast< T... > shared_type;
+	typedef typename shared_type::tuple_type tuple_type;
+
+	broadcast_writable( ) = default;
+	broadcast_writable( const broadcast_writable& ) = default;
+	broadcast_writable( broadcast_writable&& ) = default;
+
+	broadcast_writable& operator=( const broadcast_writable& ) = default;
+	broadcast_writable& operator=( broadcast_writable&& ) = default;
+
+	/**
+	 * Writes an element to all current readers. The element is stored
+	 * once, regardless of the number of readers.
+	 */
+	template< typename... Args >
+	Q_NODISCARD
+	typename std::enable_if<
+		arguments<
+			typename std::decay< Args >::type...
+		>::template is_convertible_to< arguments< T... > >::value,
+		bool
+	>::type
+	write( Args&&... args )
+	{
+		return shared_->write(
+			tuple_type( std::forward< Args >( args )... ) );
+	}
+
+	Q_NODISCARD
+	bool should_write( ) const
+	{
+		return shared_->should_write( );
+	}
+
+	void set_resume_notification( shared_task fn, bool trigger_now = false )
+	{
+		shared_->set_resume_notification( std::move( fn ), trigger_now );
+	}
+
+	void unset_resume_notification( )
+	{
+		shared_->set_resume_notification( shared_task( ), false );
+	}
+
+	Q_NODISCARD
+	bool is_closed( ) const
+	{
+		return shared_->is_closed( );
+	}
+
+	void close( )
+	{
+		shared_->close( std::make_tuple( false, std::exception_ptr( ) ) );
+	}
+
+	template< typename E >
+	void close( E&& e )
+	{
+		shared_->close( std::make_tuple(
+			true, std::make_exception_ptr( std::forward< E >( e ) ) ) );
+	}
+
+	void close( std::exception_ptr e )
+	{
+		shared_->close( std::make_tuple( true, std::move( e ) ) );
+	}
+
+	Q_NODISCARD
+	const queue_ptr& get_queue( ) const
+	{
+		return shared_->get_queue( );
+	}
+
+private:
+	broadcast_writable( std::shared_ptr< shared_type > shared )
+	: shared_( shared )
+	, owner_( q::make_shared< detail::broadcast_owner< T... > >( shared ) )
+	{ }
+
+	friend class broadcast_channel< T... >;
+
+	std::shared_ptr< shared_type > shared_;
+	std::shared_ptr< detail::broadcast_owner< T... > > owner_;
+};
+
+/**
+ * A broadcast channel has one writable side and any number of readers, which
+ * all get every element written after they subscribed. Unlike writing to one
+ * channel per reader, each element is stored once, and shared by the readers.
+ *
+ * buffer_count is the number of elements the slowest reader can fall behind
+ * before the overflow policy kicks in.
+ */
+template< typename... T >
+class broadcast_channel
+{
+public:
+	typedef detail::shared_broadcast< T... > shared_type;
+
+	broadcast_channel(
+		const queue_ptr& queue,
+		std::size_t buffer_count,
+		broadcast_overflow overflow = broadcast_overflow::backpressure
+	)
+	: broadcast_channel(
+		queue,
+		buffer_count,
+		detail::default_resume_count( buffer_count ),
+		overflow
+	)
+	{ }
+
+	broadcast_channel(
+		const queue_ptr& queue,
+		std::size_t buffer_count,
+		std::size_t resume_count,
+		broadcast_overflow overflow = broadcast_overflow::backpressure
+	)
+	: shared_( q::make_shared< shared_type >(
+		queue, buffer_count, resume_count, overflow ) )
+	, writable_( shared_ )
+	{ }
+
+	/**
+	 * Creates a new reader, which will get all elements written from now
+	 * on.
+	 */
+	broadcast_readable< T... > subscribe( )
+	{
+		return broadcast_readable< T... >( shared_ );
+	}
+
+	broadcast_writable< T... > get_writable( )
+	{
+		return writable_;
+	}
+
+	Q_NODISCARD
+	std::size_t readers( ) const
+	{
+		return shared_->readers( );
+	}
+
+	const queue_ptr& get_queue( ) const
+	{
+		return shared_->get_queue( );
+	}
+
+private:
+	std::shared_ptr< shared_type > shared_;
+	broadcast_writable< T... > writable_;
+};
+
+} // namespace q
+
+#endif // LIBQ_BROADCAST_HPP
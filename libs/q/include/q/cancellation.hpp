@@ -0,0 +1,178 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_CANCELLATION_HPP
+#define LIBQ_CANCELLATION_HPP
+
+#include <q/promise.hpp>
+
+#include <memory>
+
+namespace q {
+
+Q_MAKE_CONDITION_EXCEPTION( cancellation_exception );
+
+namespace detail {
+
+template< typename Fn, typename Args = arguments_of_t< Fn > >
+class cancellable_function;
+
+} // namespace detail
+
+/**
+ * A cancellation is a token shared by (parts of) a promise chain and the code
+ * which wants to be able to abort it, e.g. when a client disconnects.
+ *
+ * Cancelling is cheap to check for, so long running tasks can poll
+ * is_cancelled( ) and stop early. Functions wrapped with wrap( ) are not run at
+ * all once cancelled, but throw a cancellation_exception instead, so that
+ * continuations which are queued but not yet started don't perform any work,
+ * and the rest of the chain is rejected. A promise guarded with guard( ) is
+ * rejected as soon as the cancellation is cancelled, without awaiting the
+ * upstream chain.
+ *
+ * Copies of a cancellation refer to the same token.
+ */
+class cancellation
+{
+public:
+	cancellation( );
+
+	/**
+	 * Cancels, and runs (synchronously) the functions registered with
+	 * on_cancel( ). Cancelling more than once has no further effect.
+	 */
+	void cancel( );
+
+	Q_NODISCARD
+	bool is_cancelled( ) const;
+
+	/**
+	 * Throws a cancellation_exception if cancelled.
+	 */
+	void throw_if_cancelled( ) const;
+
+	/**
+	 * Registers a function to be called when cancelled. If already
+	 * cancelled, fn is called directly. The function must be fast and
+	 * must not throw.
+	 */
+	void on_cancel( task fn ) const;
+
+	/**
+	 * Registers a function to be called when cancelled, as long as owner
+	 * is alive. Registrations of expired owners are dropped when new
+	 * functions are registered, so that a long-lived cancellation doesn't
+	 * grow with every (settled) promise it has guarded.
+	 */
+	void on_cancel( task fn, std::weak_ptr< void > owner ) const;
+
+	/**
+	 * Wraps a function into a function with the same signature, which
+	 * throws a cancellation_exception instead of calling fn when
+	 * cancelled.
+	 */
+	template< typename Fn >
+	detail::cancellable_function< typename std::decay< Fn >::type >
+	wrap( Fn&& fn ) const;
+
+	/**
+	 * Returns a promise which is settled as the provided promise, or
+	 * rejected with a cancellation_exception as soon as cancelled,
+	 * whichever happens first.
+	 */
+	template< typename Promise >
+	typename std::enable_if<
+		is_promise< typename std::decay< Promise >::type >::value,
+		typename std::decay< Promise >::type::promise_type
+	>::type
+	guard( Promise&& promise ) const;
+
+private:
+	struct pimpl;
+	std::shared_ptr< pimpl > pimpl_;
+};
+
+namespace detail {
+
+template< typename Fn, typename... Args >
+class cancellable_function< Fn, arguments< Args... > >
+{
+public:
+	cancellable_function( Fn&& fn, const cancellation& cancellation )
+	: fn_( std::move( fn ) )
+	, cancellation_( cancellation )
+	{ }
+
+	cancellable_function( const Fn& fn, const cancellation& cancellation )
+	: fn_( fn )
+	, cancellation_( cancellation )
+	{ }
+
+	result_of_t< Fn > operator( )( Args... args )
+	{
+		cancellation_.throw_if_cancelled( );
+
+		return fn_( std::forward< Args >( args )... );
+	}
+
+private:
+	Fn fn_;
+	cancellation cancellation_;
+};
+
+} // namespace detail
+
+template< typename Fn >
+detail::cancellable_function< typename std::decay< Fn >::type >
+cancellation::wrap( Fn&& fn ) const
+{
+	return detail::cancellable_function< typename std::decay< Fn >::type >(
+		std::forward< Fn >( fn ), *this );
+}
+
+template< typename Promise >
+typename std::enable_if<
+	is_promise< typename std::decay< Promise >::type >::value,
+	typename std::decay< Promise >::type::promise_type
+>::type
+cancellation::guard( Promise&& promise ) const
+{
+	typedef typename std::decay< Promise >::type::tuple_type tuple_type;
+	typedef detail::race_state< tuple_type > state_type;
+
+	auto state = ::q::make_shared< state_type >( promise.get_queue( ) );
+	auto guarded = state->get_promise( );
+
+	state->add( promise );
+
+	std::weak_ptr< state_type > weak_state = state;
+
+	// The state is released when the promise settles
+	on_cancel( [ weak_state ]( )
+	{
+		auto state = weak_state.lock( );
+		if ( state )
+			state->reject( std::exception_ptr(
+				static_exception_ptr< cancellation_exception >( ) ) );
+	}, weak_state );
+
+	return guarded;
+}
+
+} // namespace q
+
+#endif // LIBQ_CANCELLATION_HPP
@@ -25,12 +25,13 @@
 #include <q/concurrency_counter.hpp>
 
 #include <list>
+#include <deque>
 #include <queue>
 #include <atomic>
 
 namespace q {
 
-Q_MAKE_SIMPLE_EXCEPTION( channel_closed_exception );
+Q_MAKE_CONDITION_EXCEPTION( channel_closed_exception );
 
 template< typename... T >
 class readable;
@@ -41,6 +42,27 @@ class writable;
 template< typename... T >
 class channel;
 
+class selector;
+
+/**
+ * Bounds for a channel buffer which is resized at runtime.
+ *
+ * The buffer starts at min. After every buffer_count written values, it is
+ * doubled if the writer was paused more often than readers had to wait for
+ * data, and halved if readers had to wait while the writer was never paused.
+ * The resume count follows the buffer count (see default_resume_count).
+ */
+struct adaptive_buffer_count
+{
+	adaptive_buffer_count( std::size_t min, std::size_t max )
+	: min( std::max< std::size_t >( min, 1 ) )
+	, max( std::max( max, this->min ) )
+	{ }
+
+	std::size_t min;
+	std::size_t max;
+};
+
 namespace detail {
 
 static constexpr std::size_t default_resume_count( std::size_t count )
@@ -215,6 +237,20 @@ public:
 	{
 		virtual ~waiter_type( ) { }
 
+		/**
+		 * Called (with the channel locked) before a value is handed to
+		 * the waiter. A waiter which is shared between multiple
+		 * channels (see q::selector) returns false if it has already
+		 * been satisfied by another channel, and is then dropped.
+		 */
+		virtual bool claim( ) { return true; }
+
+		/**
+		 * True if the waiter has been satisfied elsewhere, in which
+		 * case it can be removed without being notified.
+		 */
+		virtual bool is_abandoned( ) const { return false; }
+
 		virtual void set_closed( ) = 0;
 		virtual void set_exception( std::exception_ptr ) = 0;
 		virtual void set_value( tuple_type&& ) = 0;
@@ -226,8 +262,9 @@ public:
 		void set_closed( ) override
 		{
 			deferred->set_exception(
-				std::make_exception_ptr(
-					channel_closed_exception( ) ) );
+				static_exception_ptr<
+					channel_closed_exception
+				>( ) );
 		}
 		void set_exception( std::exception_ptr e ) override
 		{
@@ -419,21 +456,42 @@ public:
 		std::size_t buffer_count,
 		std::size_t resume_count
 	)
-	: default_queue_( queue )
-	, mutex_( Q_HERE, "channel" )
-	, close_exception_( std::make_tuple( false, std::exception_ptr( ) ) )
-	, closed_( false )
-	, paused_( false )
-	, buffer_count_( buffer_count )
-	, resume_count_( std::min( resume_count, buffer_count ) )
+	: shared_channel(
+		queue, buffer_count, resume_count, buffer_count, buffer_count )
 	{ }
 
+	shared_channel( const queue_ptr& queue, adaptive_buffer_count bounds )
+	: shared_channel(
+		queue,
+		bounds.min,
+		default_resume_count( bounds.min ),
+		bounds.min,
+		bounds.max
+	)
+	{ }
+
+	~shared_channel( )
+	{
+		account_elements( -static_cast< std::int64_t >(
+			accounted_elements_ ) );
+	}
+
+	/**
+	 * The current buffer count, which changes over time for adaptively
+	 * sized channels.
+	 */
 	Q_NODISCARD
 	std::size_t buffer_count( ) const
 	{
 		return buffer_count_;
 	}
 
+	Q_NODISCARD
+	bool is_adaptive( ) const
+	{
+		return min_buffer_count_ != max_buffer_count_;
+	}
+
 	Q_NODISCARD
 	bool is_closed( ) const
 	{
@@ -510,21 +568,32 @@ public:
 		if ( closed_.load( std::memory_order_seq_cst ) )
 			return false;
 
-		if ( waiters_.empty( ) )
-		{
-			if ( queue_.size( ) >= buffer_count_ )
-				paused_ = true;
+		bool delivered = false;
 
-			queue_.push( std::move( t ) );
-		}
-		else
+		while ( !waiters_.empty( ) )
 		{
 			auto waiter = std::move( waiters_.front( ) );
 			waiters_.pop_front( );
 
-			waiter->set_value( std::move( t ) );
+			if ( waiter->claim( ) )
+			{
+				waiter->set_value( std::move( t ) );
+				delivered = true;
+				break;
+			}
+		}
+
+		if ( !delivered )
+		{
+			if ( queue_.size( ) >= buffer_count_ && !paused_.exchange( true ) )
+				++window_pauses_;
+
+			push_buffered( std::move( t ) );
 		}
 
+		if ( is_adaptive( ) )
+			adapt_buffer_count( );
+
 		return true;
 	}
 
@@ -546,13 +615,16 @@ public:
 					default_queue_,
 					std::get< 0 >( close_exception_ )
 					? std::get< 1 >( close_exception_ )
-					: std::make_exception_ptr(
-						channel_closed_exception( ) )
+					: static_exception_ptr<
+						channel_closed_exception
+					>( )
 				);
 
 			auto defer = ::q::make_shared< defer_type >(
 				default_queue_ );
 
+			++window_idle_reads_;
+
 			waiters_.push_back(
 				::q::make_unique< defer_waiter_type >(
 					defer ) );
@@ -561,8 +633,7 @@ public:
 		}
 		else
 		{
-			tuple_type t = std::move( queue_.front( ) );
-			queue_.pop( );
+			tuple_type t = pop_buffered( );
 
 			if ( queue_.size( ) < resume_count_ && paused_ )
 			{
@@ -647,6 +718,8 @@ public:
 			auto defer = ::q::make_shared< specific_defer_type >(
 				default_queue_ );
 
+			++window_idle_reads_;
+
 			waiters_.push_back(
 				::q::make_unique< specific_waiter_type >(
 					std::forward< FnValue >( fn_value ),
@@ -661,8 +734,7 @@ public:
 		}
 		else
 		{
-			tuple_type t = std::move( queue_.front( ) );
-			queue_.pop( );
+			tuple_type t = pop_buffered( );
 
 			if ( queue_.size( ) < resume_count_ )
 			{
@@ -766,12 +838,121 @@ public:
 		Q_AUTO_UNIQUE_LOCK( mutex_ );
 
 		while ( !queue_.empty( ) )
-			queue_.pop( );
+			pop_buffered( );
+	}
+
+	/**
+	 * Registers a custom waiter. If a value is available and the waiter
+	 * can be claimed, it is satisfied immediately. If the channel is
+	 * closed, the waiter is notified about it immediately. Otherwise it
+	 * is queued until a value is written or the channel is closed.
+	 */
+	void add_waiter( std::unique_ptr< waiter_type > waiter )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( !queue_.empty( ) )
+		{
+			if ( !waiter->claim( ) )
+				return;
+
+			tuple_type t = pop_buffered( );
+
+			if ( queue_.size( ) < resume_count_ && paused_ )
+			{
+				auto self = this->shared_from_this( );
+				default_queue_->push( [ self ]( )
+				{
+					self->resume( );
+				} );
+			}
+
+			waiter->set_value( std::move( t ) );
+		}
+		else if ( closed_.load( std::memory_order_seq_cst ) )
+		{
+			if ( std::get< 0 >( close_exception_ ) )
+				waiter->set_exception(
+					std::get< 1 >( close_exception_ ) );
+			else
+				waiter->set_closed( );
+		}
+		else
+		{
+			waiters_.remove_if(
+				[ ]( const std::unique_ptr< waiter_type >& w )
+				{
+					return w->is_abandoned( );
+				}
+			);
+
+			++window_idle_reads_;
+
+			waiters_.push_back( std::move( waiter ) );
+			resume( );
+		}
 	}
 
 private:
 	template< typename... > friend class ::q::readable;
 
+	shared_channel(
+		const queue_ptr& queue,
+		std::size_t buffer_count,
+		std::size_t resume_count,
+		std::size_t min_buffer_count,
+		std::size_t max_buffer_count
+	)
+	: default_queue_( queue )
+	, mutex_( Q_HERE, "channel" )
+	, close_exception_( std::make_tuple( false, std::exception_ptr( ) ) )
+	, closed_( false )
+	, paused_( false )
+	, buffer_count_( buffer_count )
+	, resume_count_( std::min( resume_count, buffer_count ) )
+	, min_buffer_count_( min_buffer_count )
+	, max_buffer_count_( max_buffer_count )
+	, window_writes_( 0 )
+	, window_pauses_( 0 )
+	, window_idle_reads_( 0 )
+	, accounted_elements_( 0 )
+	{ }
+
+	void push_buffered( tuple_type&& t )
+	{
+		queue_.push( std::move( t ) );
+
+		if ( is_object_accounting_enabled( ) )
+		{
+			++accounted_elements_;
+			account_elements( 1 );
+		}
+	}
+
+	tuple_type pop_buffered( )
+	{
+		tuple_type t = std::move( queue_.front( ) );
+		queue_.pop( );
+
+		if ( accounted_elements_ )
+		{
+			--accounted_elements_;
+			account_elements( -1 );
+		}
+
+		return t;
+	}
+
+	static void account_elements( std::int64_t count )
+	{
+		if ( count )
+			account_objects(
+				accounted_object::channel_element,
+				count,
+				count * static_cast< std::int64_t >(
+					sizeof( tuple_type ) ) );
+	}
+
 	template< typename Tuple >
 	void _close( Tuple&& tup, bool force_exception = false )
 	{
@@ -814,6 +995,44 @@ private:
 			notification( );
 	}
 
+	/**
+	 * Called (with the channel locked) after each write to an adaptively
+	 * sized channel. Once per buffer_count writes, the buffer is grown or
+	 * shrunk depending on whether the writer or the readers had to wait
+	 * the most.
+	 */
+	void adapt_buffer_count( )
+	{
+		if ( ++window_writes_ < buffer_count_ )
+			return;
+
+		std::size_t count = buffer_count_;
+
+		if ( window_pauses_ > window_idle_reads_ )
+			count = std::min( max_buffer_count_, count * 2 );
+		else if ( window_pauses_ == 0 && window_idle_reads_ > 0 )
+			count = std::max( min_buffer_count_, count / 2 );
+
+		window_writes_ = 0;
+		window_pauses_ = 0;
+		window_idle_reads_ = 0;
+
+		if ( count == buffer_count_ )
+			return;
+
+		buffer_count_ = count;
+		resume_count_ = default_resume_count( count );
+
+		if ( paused_ && queue_.size( ) < resume_count_ )
+		{
+			auto self = this->shared_from_this( );
+			default_queue_->push( [ self ]( )
+			{
+				self->resume( );
+			} );
+		}
+	}
+
 	inline void resume( )
 	{
 		if ( paused_.exchange( false ) )
@@ -827,16 +1046,29 @@ private:
 	queue_ptr default_queue_;
 	// TODO: Make this lock-free and consider other list types
 	mutable mutex mutex_;
-	std::list< std::unique_ptr< waiter_type > > waiters_;
-	std::queue< tuple_type > queue_;
+	std::list<
+		std::unique_ptr< waiter_type >,
+		allocator< std::unique_ptr< waiter_type > >
+	> waiters_;
+	std::queue<
+		tuple_type, std::deque< tuple_type, allocator< tuple_type > >
+	> queue_;
 	// True if arbitrary exception, false if "closed exception"
 	std::tuple< bool, std::exception_ptr > close_exception_;
 	std::atomic< bool > closed_;
 	std::atomic< bool > paused_;
-	const std::size_t buffer_count_;
-	const std::size_t resume_count_;
+	std::atomic< std::size_t > buffer_count_;
+	std::atomic< std::size_t > resume_count_;
+	const std::size_t min_buffer_count_;
+	const std::size_t max_buffer_count_;
+	// Statistics for adaptively sized channels, since the last resize
+	std::size_t window_writes_;
+	std::size_t window_pauses_;
+	std::size_t window_idle_reads_;
 	shared_task resume_notification_;
 	std::vector< scope > scopes_;
+	// The number of buffered values counted by object accounting
+	std::size_t accounted_elements_;
 };
 
 template< typename... T >
@@ -1343,6 +1575,7 @@ private:
 	}
 
 	friend class channel< T... >;
+	friend class ::q::selector;
 
 	std::shared_ptr< detail::shared_channel< T... > > shared_channel_;
 	std::shared_ptr< detail::shared_channel_owner< T... > > shared_owner_;
@@ -1566,6 +1799,12 @@ public:
 		shared_channel_->add_scope_until_closed( std::move( scope ) );
 	}
 
+	Q_NODISCARD
+	std::size_t buffer_count( ) const
+	{
+		return shared_channel_->buffer_count( );
+	}
+
 	Q_NODISCARD
 	const queue_ptr& get_queue( ) const
 	{
@@ -1625,6 +1864,18 @@ public:
 	, writable_( shared_channel_ )
 	{ }
 
+	/**
+	 * Creates a channel with an adaptively sized buffer, within the given
+	 * bounds.
+	 */
+	channel( const queue_ptr& queue, adaptive_buffer_count bounds )
+	: shared_channel_(
+		q::make_shared< detail::shared_channel< T... > >(
+			queue, bounds ) )
+	, readable_( shared_channel_ )
+	, writable_( shared_channel_ )
+	{ }
+
 	readable< T... > get_readable( )
 	{
 		return readable_;
@@ -1640,6 +1891,11 @@ public:
 		shared_channel_->add_scope_until_closed( std::move( scope ) );
 	}
 
+	std::size_t buffer_count( ) const
+	{
+		return shared_channel_->buffer_count( );
+	}
+
 	const queue_ptr& get_queue( ) const
 	{
 		return shared_channel_->get_queue( );
@@ -23,10 +23,13 @@
 #include <q/expect.hpp>
 #include <q/function.hpp>
 
+#include <atomic>
 #include <memory>
 
 namespace q {
 
+struct allocator_functions;
+
 class basic_event_dispatcher;
 typedef std::shared_ptr< basic_event_dispatcher > event_dispatcher_ptr;
 typedef std::weak_ptr< basic_event_dispatcher > weak_event_dispatcher_ptr;
@@ -76,7 +79,15 @@ public:
 	virtual void set_task_fetcher( task_fetcher_task&& ) = 0;
 
 	/**
-	 * Sets the function which unloads the scheduler
+	 * Sets the function which unloads the scheduler. It must be called
+	 * before the event dispatcher is destructed, as the scheduler's queues
+	 * refer to the event dispatcher until it's unloaded.
+	 *
+	 * Custom event dispatchers must therefore call it in their destructor
+	 * at the latest, like q::threadpool and q::blocking_dispatcher do. The
+	 * queues only hold a raw pointer to the dispatcher (see
+	 * queue::set_consumer), so a dispatcher which doesn't is called after
+	 * it's destructed. It must not be called from within notify( ).
 	 */
 	virtual void set_unloader( task ) = 0;
 
@@ -86,11 +97,39 @@ public:
 	 */
 	virtual std::size_t parallelism( ) const { return 1; }
 
+	/**
+	 * Sets the allocator functions for the memory q allocates on this
+	 * event dispatcher's threads, i.e. by the tasks it runs, instead of
+	 * the process-wide ones (see q::allocator_functions). This attributes
+	 * memory to the execution context, e.g. to cap what each tenant uses.
+	 *
+	 * @throws q::invalid_argument if any of the functions is null.
+	 */
+	void set_allocator_functions( const allocator_functions& functions );
+
+	/**
+	 * The functions set with set_allocator_functions( ), or nullptr.
+	 */
+	const allocator_functions* get_allocator_functions( ) const noexcept
+	{
+		return allocator_functions_.load( std::memory_order_acquire );
+	}
+
 protected:
 	basic_event_dispatcher( )
+	: allocator_functions_( nullptr )
 	{ }
+
+private:
+	std::atomic< const allocator_functions* > allocator_functions_;
 };
 
+/**
+ * Returns the event dispatcher which the current thread runs tasks for, or
+ * nullptr if the current thread isn't a worker of an event dispatcher.
+ */
+basic_event_dispatcher* current_event_dispatcher( ) noexcept;
+
 enum class termination
 {
 	/** Wait for backlog to empty out, and allow more tasks while doing so
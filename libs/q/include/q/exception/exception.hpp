@@ -45,6 +45,23 @@
 		} \
 	}
 
+/**
+ * Makes an exception for a condition which is part of the normal control flow,
+ * e.g. a closed channel. Unlike Q_MAKE_SIMPLE_EXCEPTION, it isn't a
+ * q::exception, so no information can be added to it, and one object can be
+ * shared by every rejection with it, see q::static_exception_ptr( ).
+ */
+#define Q_MAKE_CONDITION_EXCEPTION( Name ) \
+	class Name \
+	: public ::std::exception \
+	{ \
+	public: \
+		virtual const char* what( ) const noexcept override \
+		{ \
+			return #Name ; \
+		} \
+	}
+
 #define Q_MAKE_STANDARD_EXCEPTION_OF_BASE( Name, Base ) \
 	class Name \
 	: public ::q::exception \
@@ -377,6 +394,26 @@ static inline std::string to_string( std::exception_ptr e )
 	return ss.str( );
 }
 
+/**
+ * Returns a std::exception_ptr to a default constructed E, which is created
+ * once and then shared by everyone rejecting with it, across threads. This is
+ * meant for the conditions made with Q_MAKE_CONDITION_EXCEPTION, such as
+ * q::channel_closed_exception, so that they don't cost an allocation (of the
+ * exception and the exception_ptr) every time.
+ *
+ * E must not be a q::exception, as information can be added to those when
+ * caught, which would modify the object everyone else gets too.
+ */
+template< typename E >
+const std::exception_ptr& static_exception_ptr( )
+{
+	static_assert( !is_q_exception< E >::value,
+		"q::exception objects can be modified, and can't be shared" );
+
+	static const std::exception_ptr e = std::make_exception_ptr( E( ) );
+	return e;
+}
+
 } // namespace q
 
 #endif // LIBQ_EXCEPTION_EXCEPTION_HPP
@@ -36,6 +36,14 @@ public:
 
 	scheduler_ptr scheduler( ) const;
 
+	/**
+	 * Sets the allocator functions for the memory q allocates while
+	 * running tasks in this execution context.
+	 *
+	 * @see basic_event_dispatcher::set_allocator_functions( )
+	 */
+	void set_allocator_functions( const allocator_functions& functions );
+
 protected:
 	execution_context( event_dispatcher_ptr ed, const scheduler_ptr& s );
 
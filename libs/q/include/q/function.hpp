@@ -19,6 +19,10 @@
 
 #include <q/pp.hpp>
 #include <q/functional.hpp>
+#include <q/memory.hpp>
+
+#include <atomic>
+#include <cstring>
 
 #ifdef LIBQ_ON_WINDOWS
 #	pragma warning( push )
@@ -33,11 +37,6 @@
  *
  * The following macros are available:
  *
- *   Q_RECORD_FUNCTION_STATS:
- *     Define to enable function (type and size) statistics to be printed at
- *     program exit. This slows down the application slightly (not
- *     dramatically).
- *
  *   Q_USE_FUNCTION_SIZE:
  *     The size of the q::function and q::unique_function. A larger value makes
  *     all functions take more space, but allows larger function objects (e.g.
@@ -49,13 +48,6 @@
  *     line size.
  */
 
-#ifdef Q_RECORD_FUNCTION_STATS
-#	include <unordered_map>
-#	include <map>
-#	include <iostream>
-#	include <thread>
-#endif // Q_RECORD_FUNCTION_STATS
-
 #ifdef Q_USE_FUNCTION_SIZE
 #	define LIBQ__FUNCTION_INLINE_SIZE Q_USE_FUNCTION_INLINE_SIZE
 #else
@@ -88,38 +80,126 @@ template<
 >
 struct specific_function;
 
+/**
+ * The type-erased base of the function objects wrapped by q::function and
+ * q::unique_function. Rather than using virtual functions, it points to a
+ * static table of operations for the specific function type. A call costs
+ * the same as a virtual call (loading the table pointer, then the function
+ * pointer), but the table also holds properties of the type, so that
+ * trivially relocatable inlined functions can be moved with memcpy without
+ * calling through the table at all.
+ */
 template< typename Signature, typename Ret, typename... Args >
 struct function_base
 {
 	using this_type = function_base< Signature, Ret, Args... >;
 
-	virtual ~function_base( ) { }
+	struct ops_type
+	{
+		Ret ( *call )( this_type*, Args&&... );
+		this_type* ( *move_to )( this_type*, void* );
+		std::shared_ptr< this_type > ( *move_to_shared )( this_type* );
+		std::shared_ptr< this_type > ( *copy_to_shared )( const this_type* );
+		this_type* ( *copy_to_heap )( const this_type* );
+		this_type* ( *copy_to )( const this_type*, void* );
+		void ( *destroy )( this_type* ) noexcept;
+		void ( *destroy_heap )( this_type* ) noexcept;
+		std::size_t size;
+		std::size_t alignment;
+		bool is_copyable;
+		bool is_mutable;
+		bool is_trivially_relocatable;
+	};
 
-	virtual bool is_copyable( ) const = 0;
+	/**
+	 * Deleter for functions allocated on the heap, used by the unique_ptr
+	 * and shared_ptr storage of any_function.
+	 */
+	struct heap_deleter
+	{
+		void operator( )( this_type* base ) const noexcept
+		{
+			base->ops_->destroy_heap( base );
+		}
+	};
 
-	virtual bool is_mutable( ) const = 0;
+	bool is_copyable( ) const
+	{
+		return ops_->is_copyable;
+	}
 
-	virtual Ret operator( )( Args... ) = 0;
+	bool is_mutable( ) const
+	{
+		return ops_->is_mutable;
+	}
 
-	virtual this_type* move_to( void* ) = 0;
+	bool is_trivially_relocatable( ) const
+	{
+		return ops_->is_trivially_relocatable;
+	}
 
-	virtual std::shared_ptr< this_type > move_to_shared( ) = 0;
+	Ret operator( )( Args... args )
+	{
+		return ops_->call( this, std::forward< Args >( args )... );
+	}
 
-	virtual std::shared_ptr< this_type > copy_to_shared( ) const = 0;
+	this_type* move_to( void* dest )
+	{
+		return ops_->move_to( this, dest );
+	}
 
-	virtual std::unique_ptr< this_type > copy_to_unique( ) const = 0;
+	std::shared_ptr< this_type > move_to_shared( )
+	{
+		return ops_->move_to_shared( this );
+	}
 
-	virtual this_type* copy_to( void* ) const = 0;
+	std::shared_ptr< this_type > copy_to_shared( ) const
+	{
+		return ops_->copy_to_shared( this );
+	}
 
-	virtual std::size_t size( ) const = 0;
+	std::unique_ptr< this_type, heap_deleter > copy_to_unique( ) const
+	{
+		return std::unique_ptr< this_type, heap_deleter >(
+			ops_->copy_to_heap( this ) );
+	}
+
+	this_type* copy_to( void* dest ) const
+	{
+		return ops_->copy_to( this, dest );
+	}
+
+	/**
+	 * Destructs the function in-place (for inlined functions).
+	 */
+	void destroy( ) noexcept
+	{
+		ops_->destroy( this );
+	}
+
+	std::size_t size( ) const
+	{
+		return ops_->size;
+	}
+
+	std::size_t alignment( ) const
+	{
+		return ops_->alignment;
+	}
 
 protected:
-	function_base( ) { }
-	function_base( const function_base& ) = delete;
+	function_base( const ops_type* ops )
+	: ops_( ops )
+	{ }
+
+	function_base( const function_base& ) = default;
 	function_base( function_base&& ) = default;
 
 	function_base& operator=( const function_base& ) = delete;
 	function_base& operator=( function_base&& ) = delete;
+
+private:
+	const ops_type* ops_;
 };
 
 template<
@@ -138,9 +218,12 @@ struct specific_function
 	>;
 
 	specific_function( ) = delete;
-	specific_function( specific_function&& ) = default;
+	specific_function( specific_function&& ref )
+	: base( std::move( ref ) )
+	, fn_( std::move( ref.fn_ ) )
+	{ }
 	specific_function( const specific_function& ref )
-	: function_base< Signature, Ret, Args... >( )
+	: base( ref )
 	, fn_( ref.fn_ )
 	{
 		static_assert( Copyable,
@@ -149,74 +232,119 @@ struct specific_function
 	}
 
 	specific_function( Fn&& fn )
-	: function_base< Signature, Ret, Args... >( )
+	: base( &ops )
 	, fn_( std::move( fn ) )
 	{ }
 
 	specific_function( const Fn& fn )
-	: function_base< Signature, Ret, Args... >( )
+	: base( &ops )
 	, fn_( fn )
 	{ }
 
-	~specific_function( )
-	{ }
+	/**
+	 * Functions which are trivially copyable can be relocated (moved and
+	 * the source forgotten) with memcpy.
+	 */
+	typedef bool_type<
+		std::is_trivially_copyable< Fn >::value
+	> is_trivially_relocatable;
 
-	bool is_copyable( ) const override
+	static const typename base::ops_type ops;
+
+	/**
+	 * Heap allocates a function using q's allocator functions. The memory
+	 * remembers the functions, as it's freed through a plain pointer.
+	 */
+	template< typename... A >
+	static this_type* make_heap( A&&... args )
 	{
-		return Copyable;
+		auto ptr = allocate_heap( );
+
+		try
+		{
+			return ::new ( ptr ) this_type( std::forward< A >( args )... );
+		}
+		catch ( ... )
+		{
+			deallocate_heap( ptr );
+			throw;
+		}
 	}
 
-	bool is_mutable( ) const override
+	template< typename... A >
+	static std::shared_ptr< this_type > make_shared_heap( A&&... args )
 	{
-		return is_mutable_of_t< Fn >::value;
+		return std::allocate_shared< this_type >(
+			allocator< this_type >( ), std::forward< A >( args )... );
 	}
 
-	Ret operator( )( Args... args ) override
+private:
+	static void* allocate_heap( )
 	{
-		return fn_( std::forward< Args >( args )... );
+		if ( is_over_aligned< this_type >::value )
+			return detail::allocate_aligned(
+				sizeof( this_type ), alignof( this_type ) );
+
+		return detail::allocate( sizeof( this_type ) );
 	}
 
-	base* move_to( void* dest ) override
+	static void deallocate_heap( void* ptr ) noexcept
 	{
-		return ::new ( dest ) this_type( std::move( *this ) );
+		if ( is_over_aligned< this_type >::value )
+			detail::deallocate_aligned(
+				ptr, sizeof( this_type ), alignof( this_type ) );
+		else
+			detail::deallocate( ptr, sizeof( this_type ) );
 	}
 
-	std::shared_ptr< base > move_to_shared( ) override
+	static this_type* self( base* b )
 	{
-		return std::make_shared< this_type >( std::move( *this ) );
+		return static_cast< this_type* >( b );
 	}
 
-	std::shared_ptr< base > copy_to_shared( ) const override
+	static const this_type* self( const base* b )
 	{
-		return _copy_to_shared( );
+		return static_cast< const this_type* >( b );
 	}
 
-	std::unique_ptr< base > copy_to_unique( ) const override
+	static Ret _call( base* b, Args&&... args )
 	{
-		return _copy_to_unique( );
+		return self( b )->fn_( std::forward< Args >( args )... );
 	}
 
-	base* copy_to( void* dest ) const override
+	static base* _move_to( base* b, void* dest )
 	{
-		return _copy_to( dest );
+		return ::new ( dest ) this_type( std::move( *self( b ) ) );
 	}
 
-	std::size_t size( ) const override
+	static std::shared_ptr< base > _move_to_shared( base* b )
 	{
-		return sizeof( *this );
+		return make_shared_heap( std::move( *self( b ) ) );
+	}
+
+	static void _destroy( base* b ) noexcept
+	{
+		self( b )->~this_type( );
+	}
+
+	static void _destroy_heap( base* b ) noexcept
+	{
+		auto ptr = self( b );
+
+		ptr->~this_type( );
+		deallocate_heap( ptr );
 	}
 
-private:
 	template< bool C = Copyable >
-	typename std::enable_if< C, base* >::type
-	_copy_to( void* dest ) const
+	static typename std::enable_if< C, base* >::type
+	_copy_to( const base* b, void* dest )
 	{
-		return ::new ( dest ) this_type( *this );
+		return ::new ( dest ) this_type( *self( b ) );
 	}
 
 	template< bool C = Copyable >
-	typename std::enable_if< !C, base* >::type
-	_copy_to( void* ) const
+	static typename std::enable_if< !C, base* >::type
+	_copy_to( const base*, void* )
 	{
 		// This is just to make the compiler happy. We'll never try to
 		// copy Fn from unique_function's, so this is not an issue.
@@ -224,29 +352,29 @@ private:
 	}
 
 	template< bool C = Copyable >
-	typename std::enable_if< C, std::unique_ptr< base > >::type
-	_copy_to_unique( ) const
+	static typename std::enable_if< C, base* >::type
+	_copy_to_heap( const base* b )
 	{
-		return q::make_unique< this_type >( fn_ );
+		return make_heap( *self( b ) );
 	}
 
 	template< bool C = Copyable >
-	typename std::enable_if< !C, std::unique_ptr< base > >::type
-	_copy_to_unique( ) const
+	static typename std::enable_if< !C, base* >::type
+	_copy_to_heap( const base* )
 	{
 		throw std::logic_error( "q::function internal error" );
 	}
 
 	template< bool C = Copyable >
-	typename std::enable_if< C, std::shared_ptr< base > >::type
-	_copy_to_shared( ) const
+	static typename std::enable_if< C, std::shared_ptr< base > >::type
+	_copy_to_shared( const base* b )
 	{
-		return std::make_shared< this_type >( fn_ );
+		return make_shared_heap( *self( b ) );
 	}
 
 	template< bool C = Copyable >
-	typename std::enable_if< !C, std::shared_ptr< base > >::type
-	_copy_to_shared( ) const
+	static typename std::enable_if< !C, std::shared_ptr< base > >::type
+	_copy_to_shared( const base* )
 	{
 		throw std::logic_error( "q::function internal error" );
 	}
@@ -254,6 +382,30 @@ private:
 	Fn fn_;
 };
 
+template<
+	typename Fn,
+	typename Signature,
+	bool Copyable,
+	typename Ret,
+	typename... Args
+>
+const typename function_base< Signature, Ret, Args... >::ops_type
+specific_function< Fn, Signature, Copyable, Ret, Args... >::ops = {
+	&this_type::_call,
+	&this_type::_move_to,
+	&this_type::_move_to_shared,
+	&this_type::template _copy_to_shared< >,
+	&this_type::template _copy_to_heap< >,
+	&this_type::template _copy_to< >,
+	&this_type::_destroy,
+	&this_type::_destroy_heap,
+	sizeof( this_type ),
+	alignof( this_type ),
+	Copyable,
+	is_mutable_of_t< Fn >::value,
+	is_trivially_relocatable::value
+};
+
 template< typename Fn, typename Signature, typename Ret, typename... Args >
 using specific_function_t = specific_function<
 	Fn, Signature, std::is_copy_constructible< Fn >::value, Ret, Args...
@@ -319,98 +471,38 @@ struct suitable_storage_method
 
 [[noreturn]] void _throw_bad_function_call_exception( );
 
-#ifdef Q_RECORD_FUNCTION_STATS
-template< typename T = void >
-struct function_size_recorder
+/**
+ * Whether constructed functions are recorded in the function statistics, see
+ * q::set_function_stats_enabled( ).
+ */
+inline std::atomic< bool >& function_stats_flag( ) noexcept
 {
-	void add( std::size_t sz, bool shared, function_storage type )
-	{
-		std::unique_lock< std::mutex > l( mut_ );
-		++recorded_sizes_[ sz ];
-		++shared_[ shared ];
-		++types_[ static_cast< std::uint16_t >( type ) ];
-	}
-
-	std::unordered_map< std::size_t, std::size_t > recorded_sizes_;
-	std::unordered_map< bool, std::size_t > shared_;
-	std::unordered_map< std::int16_t, std::size_t > types_;
-
-	~function_size_recorder( )
-	{
-		std::map< std::size_t, std::size_t > ordered_sizes(
-			recorded_sizes_.begin( ), recorded_sizes_.end( ) );
-
-		std::cout << "Function sizes:" << std::endl;
+	static std::atomic< bool > enabled( false );
+	return enabled;
+}
 
-		bool cache_lines[ ] = { false, false, false };
-		std::size_t cur_cache_line = 0;
-		std::size_t cache_line = 0;
-
-		auto summarize = [ & ]( std::size_t sz = 999 )
-		{
-			while (
-				cur_cache_line < 3 &&
-				!cache_lines[ cur_cache_line ] &&
-				( cur_cache_line + 1 ) * 64 < sz + 16
-			)
-			{
-				cache_lines[ cur_cache_line++ ] = true;
-				std::cout
-					<< "\t==> Up to "
-					<< ( cur_cache_line * 64 )
-					<< " - 16 bytes: "
-					<< cache_line << std::endl;
-				cache_line = 0;
-			}
-		};
-
-		for ( auto& p : ordered_sizes )
-		{
-			std::size_t sz = p.first;
-			std::size_t num = p.second;
-
-			summarize( sz );
-
-			cache_line += num;
-			std::cout
-				<< "\tSize " << sz
-				<< " allocated " << num
-				<< " times" << std::endl;
-		}
-		summarize( );
-
-		std::cout << "Methods: "
-			<< types_[ 1 ] << " plain "
-			<< types_[ 2 ] << " inlined "
-			<< types_[ 3 ] << " unique "
-			<< types_[ 4 ] << " shared."
-			<< std::endl;
-
-		std::cout << "Total: "
-			<< shared_[ false ] << " unique and "
-			<< shared_[ true ] << " shared."
-			<< std::endl;
-	}
-
-	static function_size_recorder< T > instance;
+inline bool function_stats_enabled( ) noexcept
+{
+	return function_stats_flag( ).load( std::memory_order_relaxed );
+}
 
-private:
-	std::mutex mut_;
-};
-template< typename T >
-function_size_recorder< T > function_size_recorder< T >::instance;
-#endif // Q_RECORD_FUNCTION_STATS
+/**
+ * Records a constructed function in the function statistics.
+ */
+void record_function_stats(
+	std::size_t size, bool shared, function_storage storage ) noexcept;
 
 template<
 	typename Signature,
 	typename Shared,
 	typename TotalSize,
+	typename Align,
 	typename Ret,
 	typename... Args
 >
 class
 #ifndef Q_NO_FUNCTION_ALIGN
-	alignas( LIBQ__FUNCTION_INLINE_ALIGN )
+	alignas( Align::value )
 #endif
 any_function
 : copyable_if_t< Shared::value >
@@ -422,15 +514,17 @@ public:
 		TotalSize::value - 2 * LIBQ__FUNCTION_INLINE_STATE_SIZE
 	> DataSize;
 	using this_type = any_function<
-		Signature, Shared, TotalSize, Ret, Args...
+		Signature, Shared, TotalSize, Align, Ret, Args...
 	>;
 	using shared_type = any_function<
-		Signature, std::true_type, TotalSize, Ret, Args...
+		Signature, std::true_type, TotalSize, Align, Ret, Args...
 	>;
 
 	using base = detail::function_base< Signature, Ret, Args... >;
 	using shared_heap_type = std::shared_ptr< base >;
-	using unique_heap_type = std::unique_ptr< base >;
+	using unique_heap_type = std::unique_ptr<
+		base, typename base::heap_deleter
+	>;
 
 	template<
 		typename Fn,
@@ -512,10 +606,11 @@ public:
 			Args...
 		>::type;
 
-#ifdef Q_RECORD_FUNCTION_STATS
-		function_size_recorder< >::instance.add(
-			sizeof( specific_base ), Shared::value, method::value );
-#endif // Q_RECORD_FUNCTION_STATS
+		if ( function_stats_enabled( ) )
+			record_function_stats(
+				sizeof( specific_base ),
+				Shared::value,
+				method::value );
 
 		_set_plain< method::value >( std::forward< Fn >( fn ) );
 
@@ -527,7 +622,7 @@ public:
 		{
 
 			::new ( &base_ ) unique_heap_type(
-				q::make_unique< specific_base >(
+				specific_base::make_heap(
 					std::forward< Fn >( fn ) ) );
 			ptr_ = reinterpret_cast< unique_heap_type* >( &base_ )
 				->get( );
@@ -536,7 +631,7 @@ public:
 		else if ( method::value == function_storage::shared_ptr )
 		{
 			::new ( &base_ ) shared_heap_type(
-				std::make_shared< specific_base >(
+				specific_base::make_shared_heap(
 					std::forward< Fn >( fn ) ) );
 			ptr_ = reinterpret_cast< shared_heap_type* >( &base_ )
 					->get( );
@@ -576,10 +671,11 @@ public:
 			Args...
 		>::type;
 
-#ifdef Q_RECORD_FUNCTION_STATS
-		function_size_recorder< >::instance.add(
-			sizeof( specific_base ), Shared::value, method::value );
-#endif // Q_RECORD_FUNCTION_STATS
+		if ( function_stats_enabled( ) )
+			record_function_stats(
+				sizeof( specific_base ),
+				Shared::value,
+				method::value );
 
 		_set_plain< method::value >( std::forward< Fn >( fn ) );
 
@@ -589,8 +685,7 @@ public:
 		else if ( method::value == function_storage::unique_ptr )
 		{
 			::new ( &base_ ) unique_heap_type(
-				q::make_unique< specific_base >(
-					std::move( fn ) ) );
+				specific_base::make_heap( std::move( fn ) ) );
 			ptr_ = reinterpret_cast< unique_heap_type* >( &base_ )
 				->get( );
 		}
@@ -598,7 +693,7 @@ public:
 		else if ( method::value == function_storage::shared_ptr )
 		{
 			::new ( &base_ ) shared_heap_type(
-				std::make_shared< specific_base >(
+				specific_base::make_shared_heap(
 					std::move( fn ) ) );
 			ptr_ = reinterpret_cast< shared_heap_type* >( &base_ )
 					->get( );
@@ -725,7 +820,7 @@ public:
 		{
 			shared_heap_type rebound( _base->move_to_shared( ) );
 			method_ = function_storage::uninitialized;
-			_base->~base( );
+			_base->destroy( );
 
 			::new ( &base_ ) shared_heap_type( rebound );
 			ptr_ = rebound.get( );
@@ -751,7 +846,9 @@ public:
 			auto this_unique_ptr =
 				reinterpret_cast< unique_heap_type* >( &base_ );
 
-			shared_heap_type rebound( this_unique_ptr->release( ) );
+			shared_heap_type rebound(
+				this_unique_ptr->release( ),
+				typename base::heap_deleter( ) );
 			method_ = function_storage::uninitialized;
 			this_unique_ptr->~unique_ptr( );
 
@@ -830,8 +927,105 @@ public:
 		return method_ != function_storage::uninitialized;
 	}
 
+	/**
+	 * A function which has been moved out to external memory with
+	 * compact_to( ). It only occupies compacted_size( ) bytes there,
+	 * rather than the full size of the function. This is used by queues
+	 * to store pending tasks densely.
+	 */
+	struct compacted
+	{
+		function_storage method_;
+		union
+		{
+			base* ptr_;
+			Signature* sig_;
+		};
+	};
+
+	/**
+	 * The number of bytes, and the alignment, compact_to( ) requires.
+	 */
+	std::size_t compacted_size( ) const
+	{
+		if ( method_ == function_storage::inlined )
+			return _get_base( )->size( );
+		else if ( method_ == function_storage::unique_ptr )
+			return sizeof( unique_heap_type );
+		else if ( method_ == function_storage::shared_ptr )
+			return sizeof( shared_heap_type );
+		return 0;
+	}
+
+	std::size_t compacted_alignment( ) const
+	{
+		if ( method_ == function_storage::inlined )
+			return _get_base( )->alignment( );
+		return alignof( shared_heap_type );
+	}
+
+	/**
+	 * Moves the function to dest, leaving this function empty.
+	 */
+	compacted compact_to( void* dest )
+	{
+		compacted ret;
+		ret.method_ = method_;
+
+		if ( method_ == function_storage::plain )
+			ret.sig_ = sig_;
+		else if ( method_ == function_storage::inlined )
+			ret.ptr_ = _get_base( )->move_to( dest );
+		else if ( method_ == function_storage::unique_ptr )
+		{
+			::new ( dest ) unique_heap_type( std::move(
+				*reinterpret_cast< unique_heap_type* >( &base_ ) ) );
+			ret.ptr_ = ptr_;
+		}
+		else if ( method_ == function_storage::shared_ptr )
+		{
+			::new ( dest ) shared_heap_type( std::move(
+				*reinterpret_cast< shared_heap_type* >( &base_ ) ) );
+			ret.ptr_ = ptr_;
+		}
+
+		_reset( );
+
+		return ret;
+	}
+
+	/**
+	 * Calls a function compacted with compact_to( ), where it is.
+	 */
+	static Ret call_compacted( const compacted& from, Args... args )
+	{
+		if ( from.method_ == function_storage::uninitialized )
+			detail::_throw_bad_function_call_exception( );
+
+		if ( from.method_ == function_storage::plain )
+			return ( *from.sig_ )( std::forward< Args >( args )... );
+
+		return ( *from.ptr_ )( std::forward< Args >( args )... );
+	}
+
+	/**
+	 * Destructs a function compacted to src with compact_to( ).
+	 */
+	static void destroy_compacted( const compacted& from, void* src )
+	noexcept
+	{
+		if ( from.method_ == function_storage::inlined )
+			from.ptr_->destroy( );
+		else if ( from.method_ == function_storage::unique_ptr )
+			static_cast< unique_heap_type* >( src )->~unique_ptr( );
+		else if ( from.method_ == function_storage::shared_ptr )
+			static_cast< shared_heap_type* >( src )->~shared_ptr( );
+	}
+
 private:
-	template< typename, typename, typename, typename, typename... >
+	template<
+		typename, typename, typename, typename, typename, typename...
+	>
 	friend class any_function;
 
 	template< function_storage method, typename Fn >
@@ -851,6 +1045,31 @@ private:
 	_set_plain( Fn&& )
 	{ }
 
+	/**
+	 * Moves the inlined function of other into this. Trivially relocatable
+	 * functions are just copied, as their destructors (which will still
+	 * be "called" on other) do nothing.
+	 */
+	template< typename Other >
+	void _move_inlined( Other& other )
+	{
+		auto other_base = other._get_base( );
+
+		if ( other_base->is_trivially_relocatable( ) )
+		{
+			auto offset =
+				reinterpret_cast< const char* >( other_base ) -
+				reinterpret_cast< const char* >( &other.base_ );
+
+			std::memcpy(
+				&base_, &other.base_, offset + other_base->size( ) );
+			ptr_ = reinterpret_cast< base* >(
+				reinterpret_cast< char* >( &base_ ) + offset );
+		}
+		else
+			ptr_ = other_base->move_to( &base_ );
+	}
+
 	// Beware, the constness is lost
 	base* _get_base( ) const
 	{
@@ -860,7 +1079,10 @@ private:
 	void _reset( )
 	{
 		if ( method_ == function_storage::inlined )
-			_get_base( )->~base( );
+		{
+			if ( !_get_base( )->is_trivially_relocatable( ) )
+				_get_base( )->destroy( );
+		}
 		else if ( method_ == function_storage::unique_ptr )
 			reinterpret_cast< unique_heap_type* >( &base_ )
 				->~unique_ptr( );
@@ -889,9 +1111,7 @@ private:
 		}
 		else if ( om == function_storage::inlined )
 		{
-			auto ref_base = ref._get_base( );
-
-			ptr_ = ref_base->move_to( &base_ );
+			_move_inlined( ref );
 		}
 		else if ( om == function_storage::unique_ptr )
 		{
@@ -1045,7 +1265,7 @@ private:
 		{
 			// We can place it inline, and later allow copying it
 			// if necessary.
-			ptr_ = other_base->move_to( &base_ );
+			_move_inlined( other );
 			method_ = function_storage::inlined;
 			other._reset( );
 			return *this;
@@ -1176,12 +1396,18 @@ private:
 	};
 };
 
-template< typename Signature, bool Shared, std::size_t TotalSize >
+template<
+	typename Signature,
+	bool Shared,
+	std::size_t TotalSize,
+	std::size_t Align = LIBQ__FUNCTION_INLINE_ALIGN
+>
 using any_function_t = typename ::q::arguments_of_t< Signature >
 	::template prepend<
 		Signature,
 		bool_type_t< Shared >,
 		std::integral_constant< std::size_t, TotalSize >,
+		std::integral_constant< std::size_t, Align >,
 		::q::result_of_t< Signature >
 	>
 	::template apply< any_function >;
@@ -1202,15 +1428,72 @@ using function = detail::any_function_t<
 	LIBQ__FUNCTION_INLINE_SIZE
 >;
 
-template< typename Signature, bool Shared, std::size_t Words >
+/**
+ * A function with a custom inline size (of at least Words words of captured
+ * data) and alignment, for function types which are known to capture more or
+ * less than the default.
+ */
+template<
+	typename Signature,
+	bool Shared,
+	std::size_t Words,
+	std::size_t Align = LIBQ__FUNCTION_INLINE_ALIGN
+>
 using custom_function = detail::any_function_t<
 	Signature,
 	Shared,
-	// Add three words (two for the any_function, one for the v-table),
+	// Add three words (two for the any_function, one for the ops table),
 	// then round up to nearest 8-word (assumed cache line size).
-	sizeof( std::ptrdiff_t ) * ( ( Words + 3 + 7 ) / 8 ) * 8
+	sizeof( std::ptrdiff_t ) * ( ( Words + 3 + 7 ) / 8 ) * 8,
+	Align
 >;
 
+/**
+ * Statistics of the constructed functions, per storage method and by size of
+ * the function objects, which can be used to tune the inline size of
+ * functions (see Q_USE_FUNCTION_SIZE) and to find function objects which are
+ * unexpectedly heap allocated.
+ *
+ * Functions are only recorded while recording is enabled, see
+ * set_function_stats_enabled( ).
+ */
+struct function_stats
+{
+	static constexpr std::size_t size_granularity = 16;
+	static constexpr std::size_t num_sizes = 16;
+
+	std::size_t plain;
+	std::size_t inlined;
+	std::size_t unique_ptr;
+	std::size_t shared_ptr;
+
+	std::size_t unique_functions;
+	std::size_t shared_functions;
+
+	/**
+	 * sizes[ i ] is the number of function objects larger than
+	 * i * size_granularity and at most ( i + 1 ) * size_granularity bytes.
+	 * The last one also counts all larger function objects.
+	 */
+	std::size_t sizes[ num_sizes ];
+};
+
+/**
+ * Returns the function statistics recorded by all threads since the start of
+ * the program or the last call to reset_function_stats( ).
+ */
+function_stats get_function_stats( );
+
+void reset_function_stats( );
+
+/**
+ * Enables or disables the recording of function statistics, process-wide.
+ * It's disabled by default. While disabled, constructing a function only
+ * costs a check of this flag. While enabled, the counters are per-thread, so
+ * the overhead is small.
+ */
+void set_function_stats_enabled( bool enabled ) noexcept;
+
 } // namespace q
 
 #ifdef LIBQ_ON_WINDOWS
@@ -881,6 +881,34 @@ noexcept( noexcept( fn( void_t( ) ) ) )
 	return fn( void_t( ) );
 }
 
+namespace detail {
+
+template< typename Fn, typename Tuple, std::size_t... Indexes >
+result_of_t< Fn >
+call_with_const_args_by_tuple(
+	Fn&& fn, const Tuple& tuple, q::index_tuple< Indexes... >
+)
+{
+	return fn( std::get< Indexes >( tuple )... );
+}
+
+} // namespace detail
+
+/**
+ * Like call_with_args_by_tuple, but leaves the tuple untouched and calls fn
+ * with const references to its elements.
+ */
+template< typename Fn, typename... T >
+result_of_t< Fn >
+call_with_const_args_by_tuple( Fn&& fn, const std::tuple< T... >& tuple )
+{
+	return detail::call_with_const_args_by_tuple(
+		std::forward< Fn >( fn ),
+		tuple,
+		typename make_index_tuple< sizeof...( T ) >::type( )
+	);
+}
+
 template< typename Fn, typename InnerFn, typename... Args >
 typename std::enable_if<
 	Q_IS_FUNCTION( Fn )::value
@@ -18,10 +18,14 @@
 #define LIBQ_MEMORY_HPP
 
 #include <memory>
+#include <cstddef>
 #include <q/functional.hpp>
 
 namespace q {
 
+template< typename T >
+class allocator;
+
 namespace detail {
 
 template< typename T, typename... Args >
@@ -76,7 +80,8 @@ std::shared_ptr< T >
 make_shared_using_constructor( Args&&... args )
 {
 	typedef shared_constructor< T > sub_type;
-	return std::make_shared< sub_type >( std::forward< Args >( args )... );
+	return std::allocate_shared< sub_type >(
+		allocator< sub_type >( ), std::forward< Args >( args )... );
 }
 
 /**
@@ -130,6 +135,246 @@ make_shared( Args&&... args )
 	);
 }
 
+/**
+ * The functions q uses for the memory it allocates internally, directly or
+ * through its per-thread pools:
+ *   * objects created with q::make_shared( ) and q::make_pooled_shared( ),
+ *     e.g. promise states, queues and channels
+ *   * the std::future states of promises
+ *   * heap allocated q::function objects
+ *   * the containers in queues, channels, time sets and promise signals
+ *
+ * deallocate gets the same size as was allocated. If allocate returns
+ * nullptr, q throws std::bad_alloc, which can be used to cap the memory.
+ *
+ * q::make_unique( ) is not covered, as it returns a std::unique_ptr with the
+ * default deleter, nor is memory allocated by the standard library itself,
+ * such as for std::exception_ptr.
+ *
+ * The functions can be replaced process-wide, or per execution context (see
+ * execution_context::set_allocator_functions( )), to route q's memory to
+ * custom arenas, or to account for it. Every allocation remembers the
+ * functions which allocated it and is deallocated by them, even if they
+ * have been replaced in between. They should still be set before q is used,
+ * for all memory to go through them. The default functions use
+ * ::operator new and ::operator delete.
+ *
+ * The per-thread pools allocate chunks which blocks are carved from. A
+ * chunk is charged to the functions which allocated it, and only hands out
+ * blocks while they are current, so a context is charged for the pooled
+ * memory it uses, including the empty chunks kept for reuse.
+ */
+struct allocator_functions
+{
+	void* ( *allocate )( std::size_t size );
+	void ( *deallocate )( void* ptr, std::size_t size );
+};
+
+/**
+ * Sets the process-wide allocator functions.
+ *
+ * @throws q::invalid_argument if any of the functions is null.
+ */
+void set_allocator_functions( const allocator_functions& functions );
+
+Q_NODISCARD
+allocator_functions get_allocator_functions( );
+
+namespace detail {
+
+/**
+ * The allocator functions of the current execution context, or the
+ * process-wide ones.
+ */
+const allocator_functions* current_allocator_functions( ) noexcept;
+
+/**
+ * Allocates memory using the given allocator functions, which must also be
+ * given when deallocating it.
+ */
+void* allocate( const allocator_functions* functions, std::size_t size );
+void deallocate(
+	const allocator_functions* functions, void* ptr, std::size_t size )
+noexcept;
+
+/**
+ * Allocates memory with an alignment larger than std::max_align_t, using the
+ * given allocator functions.
+ */
+void* allocate_aligned(
+	const allocator_functions* functions,
+	std::size_t size,
+	std::size_t alignment
+);
+void deallocate_aligned(
+	const allocator_functions* functions,
+	void* ptr,
+	std::size_t size,
+	std::size_t alignment
+) noexcept;
+
+/**
+ * Allocates memory using the current allocator functions, and remembers them
+ * in a header before the memory. This is for memory which is deallocated
+ * where no allocator is at hand.
+ */
+void* allocate( std::size_t size );
+void deallocate( void* ptr, std::size_t size ) noexcept;
+
+void* allocate_aligned( std::size_t size, std::size_t alignment );
+void deallocate_aligned(
+	void* ptr, std::size_t size, std::size_t alignment ) noexcept;
+
+/**
+ * Allocates memory from a pool owned by the calling thread. The pool carves
+ * blocks of a few size classes out of larger chunks, so that short-lived
+ * objects don't go through the global allocator. Memory can be deallocated
+ * from any thread; it is then handed back to the owning thread's pool. A
+ * chunk is returned to the allocator functions when all its blocks are
+ * free, except for one kept per size class. Sizes larger than the largest
+ * size class are allocated normally.
+ */
+void* pool_allocate( std::size_t size );
+
+/**
+ * Deallocates memory allocated with pool_allocate( ), with the same size.
+ */
+void pool_deallocate( void* ptr, std::size_t size ) noexcept;
+
+template< typename T >
+struct is_over_aligned
+: std::integral_constant<
+	bool, ( alignof( T ) > alignof( std::max_align_t ) )
+>
+{ };
+
+} // namespace detail
+
+/**
+ * An allocator using the allocator functions of q, for containers which q
+ * uses internally. The allocator uses the functions which are current when
+ * it's constructed, and deallocates with them too.
+ */
+template< typename T >
+class allocator
+{
+public:
+	typedef T value_type;
+
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	allocator( ) noexcept
+	: functions_( detail::current_allocator_functions( ) )
+	{ }
+
+	template< typename U >
+	allocator( const allocator< U >& other ) noexcept
+	: functions_( other.functions( ) )
+	{ }
+
+	T* allocate( std::size_t n )
+	{
+		if ( detail::is_over_aligned< T >::value )
+			return static_cast< T* >( detail::allocate_aligned(
+				functions_, n * sizeof( T ), alignof( T ) ) );
+
+		return static_cast< T* >(
+			detail::allocate( functions_, n * sizeof( T ) ) );
+	}
+
+	void deallocate( T* ptr, std::size_t n ) noexcept
+	{
+		if ( detail::is_over_aligned< T >::value )
+			detail::deallocate_aligned(
+				functions_, ptr, n * sizeof( T ), alignof( T ) );
+		else
+			detail::deallocate( functions_, ptr, n * sizeof( T ) );
+	}
+
+	const allocator_functions* functions( ) const noexcept
+	{
+		return functions_;
+	}
+
+private:
+	const allocator_functions* functions_;
+};
+
+template< typename T, typename U >
+bool operator==( const allocator< T >& a, const allocator< U >& b )
+{
+	return a.functions( ) == b.functions( );
+}
+
+template< typename T, typename U >
+bool operator!=( const allocator< T >& a, const allocator< U >& b )
+{
+	return !( a == b );
+}
+
+/**
+ * An allocator using the per-thread pools of q. Unlike q::allocator, it
+ * keeps no state, as pooled blocks know where they belong. Over-aligned
+ * types aren't pooled.
+ */
+template< typename T >
+class pool_allocator
+{
+public:
+	typedef T value_type;
+
+	pool_allocator( ) = default;
+
+	template< typename U >
+	pool_allocator( const pool_allocator< U >& ) noexcept
+	{ }
+
+	T* allocate( std::size_t n )
+	{
+		if ( detail::is_over_aligned< T >::value )
+			return static_cast< T* >( detail::allocate_aligned(
+				n * sizeof( T ), alignof( T ) ) );
+
+		return static_cast< T* >( detail::pool_allocate( n * sizeof( T ) ) );
+	}
+
+	void deallocate( T* ptr, std::size_t n ) noexcept
+	{
+		if ( detail::is_over_aligned< T >::value )
+			detail::deallocate_aligned(
+				ptr, n * sizeof( T ), alignof( T ) );
+		else
+			detail::pool_deallocate( ptr, n * sizeof( T ) );
+	}
+};
+
+template< typename T, typename U >
+bool operator==( const pool_allocator< T >&, const pool_allocator< U >& )
+{
+	return true;
+}
+
+template< typename T, typename U >
+bool operator!=( const pool_allocator< T >&, const pool_allocator< U >& )
+{
+	return false;
+}
+
+/**
+ * Like make_shared_using_constructor( ), but allocates the object (and its
+ * reference counter) using a q::pool_allocator. This is suitable for small
+ * objects which are created and destroyed at a high rate.
+ */
+template< typename T, typename... Args >
+std::shared_ptr< T >
+make_pooled_shared( Args&&... args )
+{
+	typedef shared_constructor< T > sub_type;
+	return std::allocate_shared< sub_type >(
+		pool_allocator< sub_type >( ), std::forward< Args >( args )... );
+}
+
 } // namespace q
 
 #endif // LIBQ_MEMORY_HPP
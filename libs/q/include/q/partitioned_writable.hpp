@@ -0,0 +1,252 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PARTITIONED_WRITABLE_HPP
+#define LIBQ_PARTITIONED_WRITABLE_HPP
+
+#include <q/channel.hpp>
+
+#include <vector>
+
+namespace q {
+
+/**
+ * A partitioned_writable routes every written value to one of a set of shard
+ * writables, chosen by hashing a key extracted from the value. Values with the
+ * same key always end up in the same shard, and are thereby kept in order,
+ * while values with different keys can be consumed in parallel.
+ *
+ * The key function is called with const references to the values, and can
+ * return anything std::hash can handle.
+ *
+ * Writing is synchronous, there is no extra queue hop or promise per value.
+ * should_write( ) is false as long as any of the shards is full.
+ */
+template< typename... T >
+class partitioned_writable
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+	typedef q::function< std::size_t( const T&... ) > partition_function;
+
+	/**
+	 * Creates `partitions` new channels, which are readable through
+	 * get_readable( ).
+	 *
+	 * @throws q::invalid_argument if `partitions` is 0.
+	 */
+	template< typename Fn >
+	partitioned_writable(
+		const queue_ptr& queue,
+		Fn&& key_fn,
+		std::size_t partitions,
+		std::size_t buffer_count
+	)
+	: state_( q::make_shared< state >(
+		make_partition_function( std::forward< Fn >( key_fn ) ) ) )
+	{
+		if ( partitions == 0 )
+			Q_THROW( invalid_argument(
+				"partitioned_writable needs at least one partition" ) );
+
+		for ( std::size_t i = 0; i < partitions; ++i )
+		{
+			channel< T... > ch( queue, buffer_count );
+
+			state_->readables.push_back( ch.get_readable( ) );
+			state_->writables.push_back( ch.get_writable( ) );
+		}
+	}
+
+	/**
+	 * Routes to existing writables.
+	 *
+	 * @throws q::invalid_argument if `shards` is empty.
+	 */
+	template< typename Fn >
+	partitioned_writable(
+		std::vector< writable< T... > > shards,
+		Fn&& key_fn
+	)
+	: state_( q::make_shared< state >(
+		make_partition_function( std::forward< Fn >( key_fn ) ) ) )
+	{
+		if ( shards.empty( ) )
+			Q_THROW( invalid_argument(
+				"partitioned_writable needs at least one shard" ) );
+
+		state_->writables = std::move( shards );
+	}
+
+	partitioned_writable( const partitioned_writable& ) = default;
+	partitioned_writable( partitioned_writable&& ) = default;
+
+	partitioned_writable& operator=( const partitioned_writable& ) = default;
+	partitioned_writable& operator=( partitioned_writable&& ) = default;
+
+	/**
+	 * Writes the values to the shard their key belongs to. Returns false
+	 * if this shard is closed.
+	 */
+	template< typename... Args >
+	Q_NODISCARD
+	typename std::enable_if<
+		arguments<
+			typename std::decay< Args >::type...
+		>::template is_convertible_to< arguments< T... > >::value,
+		bool
+	>::type
+	write( Args&&... args )
+	{
+		tuple_type t( std::forward< Args >( args )... );
+
+		return shard_of( t ).write( std::move( t ) );
+	}
+
+	Q_NODISCARD
+	std::size_t size( ) const
+	{
+		return state_->writables.size( );
+	}
+
+	/**
+	 * The readable of shard `index`, when the shard channels were created
+	 * by this partitioned_writable.
+	 */
+	Q_NODISCARD
+	readable< T... > get_readable( std::size_t index ) const
+	{
+		return state_->readables.at( index );
+	}
+
+	Q_NODISCARD
+	writable< T... > get_writable( std::size_t index ) const
+	{
+		return state_->writables.at( index );
+	}
+
+	Q_NODISCARD
+	bool should_write( ) const
+	{
+		return state_->should_write( );
+	}
+
+	/**
+	 * Sets a notification which is called when all shards accept writes
+	 * again. It can be called more than once per resume, if multiple
+	 * shards resume at the same time.
+	 */
+	void set_resume_notification( shared_task fn, bool trigger_now = false )
+	{
+		std::weak_ptr< state > weak_state = state_;
+
+		shared_task notification = [ weak_state, fn ]( ) mutable
+		{
+			auto state = weak_state.lock( );
+			if ( state && state->should_write( ) )
+				fn( );
+		};
+
+		for ( auto& shard : state_->writables )
+			shard.set_resume_notification( notification, false );
+
+		if ( trigger_now && should_write( ) )
+			notification( );
+	}
+
+	void unset_resume_notification( )
+	{
+		for ( auto& shard : state_->writables )
+			shard.unset_resume_notification( );
+	}
+
+	/**
+	 * True if any of the shards is closed.
+	 */
+	Q_NODISCARD
+	bool is_closed( ) const
+	{
+		for ( auto& shard : state_->writables )
+			if ( shard.is_closed( ) )
+				return true;
+
+		return false;
+	}
+
+	void close( )
+	{
+		for ( auto& shard : state_->writables )
+			shard.close( );
+	}
+
+	template< typename E >
+	void close( E&& e )
+	{
+		for ( auto& shard : state_->writables )
+			shard.close( e );
+	}
+
+private:
+	struct state
+	{
+		state( partition_function fn )
+		: fn( std::move( fn ) )
+		{ }
+
+		bool should_write( ) const
+		{
+			for ( auto& shard : writables )
+				if ( !shard.should_write( ) )
+					return false;
+
+			return true;
+		}
+
+		partition_function fn;
+		std::vector< writable< T... > > writables;
+		std::vector< readable< T... > > readables;
+	};
+
+	template< typename Fn >
+	static partition_function make_partition_function( Fn&& key_fn )
+	{
+		auto _fn = decay_function( std::forward< Fn >( key_fn ) );
+
+		typedef typename std::decay<
+			result_of_t< decltype( _fn ) >
+		>::type key_type;
+
+		return [ _fn ]( const T&... t ) -> std::size_t
+		{
+			return std::hash< key_type >( )( _fn( t... ) );
+		};
+	}
+
+	writable< T... >& shard_of( const tuple_type& t )
+	{
+		auto& writables = state_->writables;
+
+		std::size_t hash = call_with_const_args_by_tuple( state_->fn, t );
+
+		return writables[ hash % writables.size( ) ];
+	}
+
+	std::shared_ptr< state > state_;
+};
+
+} // namespace q
+
+#endif // LIBQ_PARTITIONED_WRITABLE_HPP
@@ -26,6 +26,7 @@
 #include <q/memory.hpp>
 #include <q/set_default.hpp>
 #include <q/options.hpp>
+#include <q/accounting.hpp>
 
 #include <q/promise/async_task.hpp>
 #include <q/promise/core.hpp>
@@ -36,7 +37,9 @@
 #include <q/promise/reject.hpp>
 #include <q/promise/with.hpp>
 #include <q/promise/all.hpp>
+#include <q/promise/race.hpp>
 #include <q/promise/make.hpp>
+#include <q/promise/lazy.hpp>
 #include <q/promise/delay.hpp>
 #include <q/promise/promisify.hpp>
 #include <q/promise/impl/then.hpp>
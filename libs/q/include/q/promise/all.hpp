@@ -20,7 +20,8 @@
 #include <q/temporarily_copyable.hpp>
 #include <q/type_traits.hpp>
 
-#include <algorithm>
+#include <atomic>
+#include <vector>
 
 namespace q {
 
@@ -34,7 +35,118 @@ all( Promise&& promise )
 	return std::forward< Promise >( promise );
 }
 
-// TODO: Consider a different, less recursive, design
+namespace detail {
+
+/**
+ * The shared state of a variadic q::all( ). Every promise writes its settled
+ * value into its own slot, and the slots are concatenated into the final tuple
+ * once, when the last promise is settled. The first rejection rejects the
+ * combined promise right away, and the remaining results are still collected
+ * (and dropped) as they settle.
+ */
+template< typename... Tuples >
+class all_variadic_state
+: public std::enable_shared_from_this< all_variadic_state< Tuples... > >
+{
+public:
+	typedef decltype( std::tuple_cat( std::declval< Tuples >( )... ) )
+		tuple_type;
+	typedef typename tuple_arguments_t< tuple_type >
+		::template apply< defer > defer_type;
+	typedef typename ::q::make_index_tuple< sizeof...( Tuples ) >::type
+		indexes_type;
+
+	all_variadic_state( const queue_ptr& queue )
+	: deferred_( ::q::make_shared< defer_type >( queue ) )
+	, queue_( queue )
+	, counter_( sizeof...( Tuples ) )
+	, failed_( false )
+	{ }
+
+	template< typename... Promises >
+	void add( Promises&... promises )
+	{
+		add_all( indexes_type( ), promises... );
+	}
+
+	typename defer_type::promise_type get_promise( )
+	{
+		return deferred_->get_promise( );
+	}
+
+private:
+	template< std::size_t... Indexes, typename... Promises >
+	void add_all( ::q::index_tuple< Indexes... >, Promises&... promises )
+	{
+		int dummy[ ] = { ( add_one< Indexes >( promises ), 0 )... };
+		(void)dummy;
+	}
+
+	template< std::size_t Index, typename Promise >
+	void add_one( Promise& promise )
+	{
+		typedef typename std::tuple_element<
+			Index, std::tuple< Tuples... >
+		>::type element_type;
+
+		auto self = this->shared_from_this( );
+
+		promise.on_settled( [ self ]( expect< element_type >&& exp )
+		{
+			if (
+				exp.has_exception( ) &&
+				!self->failed_.exchange(
+					true, std::memory_order_acq_rel )
+			)
+			{
+				// First rejection
+				auto e = exp.exception( );
+
+				self->queue_->push( [ self, e ]( )
+				{
+					self->deferred_->set_exception( e );
+				} );
+			}
+
+			std::get< Index >( self->data_ ) = std::move( exp );
+
+			auto prev = self->counter_.fetch_sub(
+				1, std::memory_order_acq_rel );
+
+			if (
+				prev == 1 && // Last promise
+				!self->failed_.load( std::memory_order_acquire )
+			)
+				self->queue_->push( [ self ]( )
+				{
+					self->resolve( indexes_type( ) );
+				} );
+		} );
+	}
+
+	template< std::size_t... Indexes >
+	void resolve( ::q::index_tuple< Indexes... > )
+	{
+		deferred_->set_value( std::tuple_cat(
+			std::get< Indexes >( data_ ).consume( )... ) );
+	}
+
+	std::shared_ptr< defer_type > deferred_;
+	queue_ptr queue_;
+	std::tuple< expect< Tuples >... > data_;
+	std::atomic< std::size_t > counter_;
+	std::atomic< bool > failed_;
+};
+
+} // namespace detail
+
+/**
+ * Combines a set of promises into one promise which resolves to the values of
+ * all promises, concatenated in order, e.g. all( P< A >, P< B, C > ) becomes
+ * P< A, B, C >. If any promise is rejected, the resulting promise is rejected
+ * right away with the exception of the first promise to be rejected, without
+ * waiting for the rest to settle.
+ */
 template< typename First, typename... Rest >
 typename std::enable_if<
 	are_promises<
@@ -49,342 +161,237 @@ typename std::enable_if<
 >::type
 all( First&& first, Rest&&... rest )
 {
-	auto when_rest = Q_FORWARD( all( std::forward< Rest >( rest )... ) );
-	auto when_rest_tmp = Q_MOVE_TEMPORARILY_COPYABLE( when_rest );
-
-	typedef typename std::decay< First >::type::tuple_type
-		first_tuple_type;
-	typedef typename merge_promise_arguments< Rest... >::tuple_type
-		rest_tuple_type;
-	typedef typename merge_promise_arguments< First, Rest... >::tuple_type
-		full_tuple_type;
-
-	return first.then( [ when_rest_tmp ]( first_tuple_type&& data ) mutable
-	-> detail::suitable_promise_t< full_tuple_type >
-	{
-		auto rest_promise = when_rest_tmp.consume( );
-		auto data_tmp = Q_MOVE_TEMPORARILY_COPYABLE( data );
+	typedef detail::all_variadic_state<
+		typename std::decay< First >::type::tuple_type,
+		typename std::decay< Rest >::type::tuple_type...
+	> state_type;
 
-		auto failer = [ ]( std::exception_ptr&& e ) mutable
-		-> rest_tuple_type
-		{
-			std::rethrow_exception( e );
-		};
-
-		auto completer = [ data_tmp ]
-		                 ( rest_tuple_type&& rest_data ) mutable
-		-> full_tuple_type
-		{
-			return std::tuple_cat(
-				data_tmp.consume( ),
-				std::move( rest_data ) );
-		};
+	auto state = ::q::make_shared< state_type >( first.get_queue( ) );
 
-		auto full_value = rest_promise.fail( failer ).then( completer );
+	state->add( first, rest... );
 
-		return std::move( full_value );
-	} );
+	return state->get_promise( );
 }
 
 namespace detail {
 
+/**
+ * Describes how the settled q::expect< tuple > of every promise in a list is
+ * stored by q::all( ), and how the combined promise is resolved. Promises of
+ * zero or one value are stored without the tuple.
+ */
 template<
-	typename List,
-	std::size_t TupleSize = std::tuple_size<
-		typename std::decay< List >::type::value_type::tuple_type
-	>::value
+	typename Tuple,
+	std::size_t TupleSize = std::tuple_size< Tuple >::value
 >
-struct all_return_type
+struct all_element
 {
-	typedef std::tuple<
-		std::vector<
-			typename std::decay<
-				List
-			>::type::value_type::tuple_type
-		>
-	> tuple_type;
+	typedef Tuple                       element_type;
+	typedef std::vector< element_type > return_type;
+	typedef std::tuple< return_type >   tuple_type;
+	typedef defer< return_type >        defer_type;
+
+	static expect< element_type > make_expect( expect< Tuple >&& exp )
+	{
+		return std::move( exp );
+	}
+
+	static void set_value(
+		defer_type& deferred,
+		std::vector< expect< element_type > >& data
+	)
+	{
+		return_type returns;
+		returns.reserve( data.size( ) );
+
+		for ( auto& exp : data )
+			returns.push_back( exp.consume( ) );
+
+		deferred.set_value( std::move( returns ) );
+	}
 };
 
-template< typename List >
-struct all_return_type< List, 1 >
+template< typename Tuple >
+struct all_element< Tuple, 1 >
 {
-	typedef std::tuple<
-		std::vector<
-			typename std::tuple_element<
-				0,
-				typename std::decay<
-					List
-				>::type::value_type::tuple_type
-			>::type
-		>
-	> tuple_type;
+	typedef typename std::tuple_element< 0, Tuple >::type element_type;
+	typedef std::vector< element_type >                   return_type;
+	typedef std::tuple< return_type >                     tuple_type;
+	typedef defer< return_type >                          defer_type;
+
+	static expect< element_type > make_expect( expect< Tuple >&& exp )
+	{
+		if ( exp.has_exception( ) )
+			return refuse< element_type >( exp.exception( ) );
+
+		return fulfill< element_type >(
+			std::move( std::get< 0 >( exp.consume( ) ) ) );
+	}
+
+	static void set_value(
+		defer_type& deferred,
+		std::vector< expect< element_type > >& data
+	)
+	{
+		return_type returns;
+		returns.reserve( data.size( ) );
+
+		for ( auto& exp : data )
+			returns.push_back( exp.consume( ) );
+
+		deferred.set_value( std::move( returns ) );
+	}
 };
 
-template< typename List >
-struct all_return_type< List, 0 >
+template< typename Tuple >
+struct all_element< Tuple, 0 >
 {
+	typedef void          element_type;
 	typedef std::tuple< > tuple_type;
+	typedef defer< >      defer_type;
+
+	static expect< void > make_expect( expect< Tuple >&& exp )
+	{
+		if ( exp.has_exception( ) )
+			return refuse< void >( exp.exception( ) );
+
+		return fulfill< void >( );
+	}
+
+	static void set_value(
+		defer_type& deferred,
+		std::vector< expect< void > >&
+	)
+	{
+		deferred.set_value( );
+	}
 };
 
-} // namespace detail
+template< typename List >
+struct all_return_type
+{
+	typedef typename all_element<
+		typename std::decay< List >::type::value_type::tuple_type
+	>::tuple_type tuple_type;
+};
 
 /**
- * Combines a std::vector of promises (of the same type) into one promise
- * which resolves to a std::vector of the combined result types, in order.
- *
- * If the list of promises contain std::tuples with zero or one elements, the
- * resulting promise will be a promise of a std::vector of the values within
- * the tuples (or a promise without a value) wrapped in q::expect.
- * If the promises contain std::tuples with two or more elements, the
- * resulting promise will contain a list of std::tuples wrapped in q::expect.
+ * The single shared state of a q::all( ) of a list of promises. Every element
+ * writes its result directly into its own preallocated slot, and the last one
+ * to settle schedules the resolution of the combined promise.
  */
-template< typename List >
-typename std::enable_if<
-	is_vector< List >::value &&
-	is_promise< typename std::decay< List >::type::value_type >::value &&
-	( std::tuple_size<
-		typename std::decay< List >::type::value_type::tuple_type
-	>::value >= 2 ),
-	detail::suitable_promise_t<
-		typename detail::all_return_type< List >::tuple_type
-	>
->::type
-all( List&& list, const queue_ptr& queue )
+template< typename Tuple >
+class all_state
+: public std::enable_shared_from_this< all_state< Tuple > >
 {
-	typedef typename std::decay< List >::type          list_type;
-	typedef typename list_type::value_type::tuple_type element_type;
+public:
+	typedef all_element< Tuple >                       element;
+	typedef typename element::element_type             element_type;
 	typedef expect< element_type >                     expect_type;
-	typedef std::vector< element_type >                return_type;
-	typedef std::vector< expect_type >                 expect_return_type;
 	typedef combined_promise_exception< element_type > exception_type;
 
-	auto deferred = ::q::make_shared< detail::defer< return_type > >(
-		queue );
+	all_state( std::size_t num, const queue_ptr& queue )
+	: deferred_( ::q::make_shared< typename element::defer_type >( queue ) )
+	, queue_( queue )
+	, data_( num )
+	, counter_( num )
+	, any_failure_( false )
+	{ }
 
-	std::size_t num = list.size( );
-	auto expect_returns = std::make_shared< expect_return_type >( num );
-	auto counter = std::make_shared< std::atomic< std::size_t > >( num );
-	auto any_failure = std::make_shared< std::atomic< bool > >( false );
-
-	auto resolver = [ deferred, expect_returns, any_failure ]( )
+	template< typename Promise >
+	void add( std::size_t index, Promise& promise )
 	{
-		if ( any_failure->load( std::memory_order_seq_cst ) )
-		{
-			// At least one element's promise failed
-			deferred->set_exception(
-				std::make_exception_ptr(
-					exception_type(
-						std::move( *expect_returns )
-					)
-				)
-			);
-		}
-		else
+		auto self = this->shared_from_this( );
+
+		promise.on_settled( [ self, index ]( expect< Tuple >&& exp )
 		{
-			auto returns = return_type( expect_returns.size( ) );
-			std::transform(
-				expect_returns->begin( ),
-				expect_returns->end( ),
-				returns.begin( ),
-				[ ]( expect_type& data )
-				{
-					return std::move( data.consume( ) );
-				} );
+			self->settle( index, std::move( exp ) );
+		} );
+	}
 
-			deferred->set_value( std::move( returns ) );
-		}
-	};
+	typename element::defer_type::promise_type get_promise( )
+	{
+		if ( data_.empty( ) )
+			resolve( );
 
-	auto part_completion = [ expect_returns, counter, resolver ]
-	                       ( std::size_t index, expect_type&& data ) mutable
+		return deferred_->get_promise( );
+	}
+
+private:
+	void settle( std::size_t index, expect< Tuple >&& exp )
 	{
-		expect_returns->at( index ) = std::move( data );
+		if ( exp.has_exception( ) )
+			any_failure_.store( true, std::memory_order_relaxed );
 
-		auto prev = counter->fetch_sub( 1, std::memory_order_seq_cst );
+		data_[ index ] = element::make_expect( std::move( exp ) );
 
-		if ( prev == 1 ) // Last element
-			resolver( );
-	};
+		auto prev = counter_.fetch_sub( 1, std::memory_order_acq_rel );
 
-	for ( std::size_t i = 0; i < num; ++i )
-		list[ i ]
-		.fail( [ i, part_completion, any_failure ]
-		       ( std::exception_ptr&& e ) mutable
-		{
-			any_failure->store( true, std::memory_order_seq_cst );
-			part_completion(
-				i,
-				refuse< element_type >( std::move( e ) ) );
-		} )
-		.then( [ i, part_completion ]
-		       ( element_type&& data ) mutable
+		if ( prev == 1 ) // Last element
 		{
-			part_completion(
-				i,
-				fulfill< element_type >( std::move( data ) ) );
-		} );
-
-	return deferred->get_promise( );
-}
+			// Settling must be fast, so the (linear) resolution is
+			// performed on the queue instead
+			auto self = this->shared_from_this( );
+
+			queue_->push( [ self ]( )
+			{
+				self->resolve( );
+			} );
+		}
+	}
 
-template< typename List >
-typename std::enable_if<
-	is_vector< List >::value &&
-	is_promise< typename std::decay< List >::type::value_type >::value &&
-	std::tuple_size<
-		typename std::decay< List >::type::value_type::tuple_type
-	>::value == 1,
-	detail::suitable_promise_t<
-		typename detail::all_return_type< List >::tuple_type
-	>
->::type
-all( List&& list, const queue_ptr& queue )
-{
-	typedef typename std::decay< List >::type                  list_type;
-	typedef typename list_type::value_type::tuple_type         tuple_type;
-	typedef typename std::tuple_element< 0, tuple_type >::type element_type;
-	typedef expect< element_type >                             expect_type;
-	typedef std::vector< element_type >                        return_type;
-	typedef std::vector< expect_type >                         expect_return_type;
-	typedef combined_promise_exception< element_type >         exception_type;
-
-	auto deferred = ::q::make_shared< detail::defer< return_type > >(
-		queue );
-
-	std::size_t num = list.size( );
-	auto expect_returns = std::make_shared< expect_return_type >( num );
-	auto counter = std::make_shared< std::atomic< std::size_t > >( num );
-	auto any_failure = std::make_shared< std::atomic< bool > >( false );
-
-	auto resolver = [ deferred, expect_returns, any_failure ]( )
+	void resolve( )
 	{
-		if ( any_failure->load( std::memory_order_seq_cst ) )
-		{
+		if ( any_failure_.load( std::memory_order_relaxed ) )
 			// At least one element's promise failed
-			deferred->set_exception(
+			deferred_->set_exception(
 				std::make_exception_ptr(
-					exception_type(
-						std::move( *expect_returns )
-					)
-				)
-			);
-		}
+					exception_type( std::move( data_ ) ) ) );
 		else
-		{
-			auto returns = return_type( expect_returns->size( ) );
-			std::transform(
-				expect_returns->begin( ),
-				expect_returns->end( ),
-				returns.begin( ),
-				[ ]( expect_type& data )
-				{
-					return std::move( data.consume( ) );
-				} );
-
-			deferred->set_value( std::move( returns ) );
-		}
-	};
-
-	auto part_completion = [ expect_returns, counter, resolver ]
-	                       ( std::size_t index, expect_type&& data ) mutable
-	{
-		expect_returns->at( index ) = std::move( data );
-
-		auto prev = counter->fetch_sub( 1, std::memory_order_seq_cst );
-
-		if ( prev == 1 ) // Last element
-			resolver( );
-	};
-
-	for ( std::size_t i = 0; i < num; ++i )
-		list[ i ]
-		.then( [ i, part_completion ]
-		       ( element_type&& data ) mutable
-		{
-			part_completion(
-				i,
-				fulfill< element_type >( std::move( data ) ) );
-		}, queue )
-		.fail( [ i, part_completion, any_failure ]
-		       ( std::exception_ptr&& e ) mutable
-		{
-			any_failure->store( true, std::memory_order_seq_cst );
-			part_completion(
-				i,
-				refuse< element_type >( std::move( e ) ) );
-		}, queue );
+			element::set_value( *deferred_, data_ );
+	}
+
+	std::shared_ptr< typename element::defer_type > deferred_;
+	queue_ptr queue_;
+	std::vector< expect_type > data_;
+	std::atomic< std::size_t > counter_;
+	std::atomic< bool > any_failure_;
+};
 
-	return deferred->get_promise( );
-}
+} // namespace detail
 
+/**
+ * Combines a std::vector of promises (of the same type) into one promise
+ * which resolves to a std::vector of the combined result types, in order.
+ *
+ * If the list of promises contain std::tuples with zero or one elements, the
+ * resulting promise will be a promise of a std::vector of the values within
+ * the tuples (or a promise without a value) wrapped in q::expect.
+ * If the promises contain std::tuples with two or more elements, the
+ * resulting promise will contain a list of std::tuples wrapped in q::expect.
+ *
+ * An empty list results in a promise resolved to an empty std::vector.
+ */
 template< typename List >
 typename std::enable_if<
 	is_vector< typename std::decay< List >::type >::value &&
-	is_promise< typename std::decay< List >::type::value_type >::value &&
-	std::tuple_size<
-		typename std::decay< List >::type::value_type::tuple_type
-	>::value == 0,
+	is_promise< typename std::decay< List >::type::value_type >::value,
 	detail::suitable_promise_t<
 		typename detail::all_return_type< List >::tuple_type
 	>
 >::type
 all( List&& list, const queue_ptr& queue )
 {
-	typedef expect< void >                     expect_type;
-	typedef std::vector< expect_type >         expect_return_type;
-	typedef combined_promise_exception< void > exception_type;
-
-	auto deferred = ::q::make_shared< detail::defer< > >( queue );
+	typedef typename std::decay< List >::type::value_type::tuple_type
+		tuple_type;
 
-	std::size_t num = list.size( );
-	auto expect_returns = std::make_shared< expect_return_type >( num );
-	auto counter = std::make_shared< std::atomic< std::size_t > >( num );
-	auto any_failure = std::make_shared< std::atomic< bool > >( false );
+	auto state = ::q::make_shared< detail::all_state< tuple_type > >(
+		list.size( ), queue );
 
-	auto resolver = [ deferred, expect_returns, any_failure ]( )
-	{
-		if ( any_failure->load( std::memory_order_seq_cst ) )
-		{
-			// At least one element's promise failed
-			deferred->set_exception(
-				std::make_exception_ptr(
-					exception_type(
-						std::move( *expect_returns )
-					)
-				)
-			);
-		}
-		else
-		{
-			deferred->set_value( );
-		}
-	};
-
-	auto part_completion = [ expect_returns, counter, resolver ]
-	                       ( std::size_t index, expect_type&& data ) mutable
-	{
-		expect_returns->at( index ) = std::move( data );
-
-		auto prev = counter->fetch_sub( 1, std::memory_order_seq_cst );
-
-		if ( prev == 1 ) // Last element
-			resolver( );
-	};
-
-	for ( std::size_t i = 0; i < num; ++i )
-		list[ i ]
-		.fail( [ i, part_completion, any_failure ]
-		       ( std::exception_ptr&& e ) mutable
-		{
-			any_failure->store( true, std::memory_order_seq_cst );
-			part_completion( i, refuse< void >( std::move( e ) ) );
-		}, queue )
-		.then( [ i, part_completion ]( ) mutable
-		{
-			part_completion( i, fulfill< void >( ) );
-		}, queue );
+	for ( std::size_t i = 0; i < list.size( ); ++i )
+		state->add( i, list[ i ] );
 
-	return deferred->get_promise( );
+	return state->get_promise( );
 }
 
 } // namespace q
@@ -34,6 +34,13 @@ template< bool, typename... > class generic_promise;
 
 } // namespace detail
 
+/**
+ * A promise is rejected with this exception if it is abandoned, i.e. if the
+ * last reference to its defer (e.g. the resolver and rejecter given by
+ * make_promise) is destroyed without the promise being settled.
+ */
+Q_MAKE_SIMPLE_EXCEPTION( abandoned_promise_exception );
+
 template< class T >
 struct is_promise
 : std::false_type
@@ -146,7 +153,7 @@ public:
 				add_exception( element.exception( ) );
 	}
 
-	const std::vector< expect< T > >& data( )
+	const std::vector< expect< T > >& data( ) const
 	{
 		return *data_;
 	}
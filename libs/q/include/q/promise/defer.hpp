@@ -105,6 +105,7 @@ public:
 	inline void set_value( tuple_type&& tuple )
 	{
 		auto value = ::q::fulfill< tuple_type >( std::move( tuple ) );
+		settled_ = true;
 		promise_.set_value( std::move( value ) );
 		signal_->done( );
 	}
@@ -112,6 +113,7 @@ public:
 	inline void set_value( const tuple_type& tuple )
 	{
 		auto value = ::q::fulfill< tuple_type >( tuple_type( tuple ) );
+		settled_ = true;
 		promise_.set_value( std::move( value ) );
 		signal_->done( );
 	}
@@ -157,6 +159,7 @@ public:
 
 	void set_exception( const std::exception_ptr& e )
 	{
+		settled_ = true;
 		promise_.set_value( ::q::refuse< tuple_type >( e ) );
 		signal_->done( );
 	}
@@ -567,7 +570,8 @@ public:
 	{
 		typedef typename state_data_type::future_type future_type;
 
-		std::promise< expect_type > std_promise;
+		std::promise< expect_type > std_promise(
+			std::allocator_arg, pool_allocator< expect_type >( ) );
 		future_type future = std_promise.get_future( );
 
 		state_data_type state_data( std::move( future ) );
@@ -577,7 +581,7 @@ public:
 
 		promise_type q_promise( std::move( state ), queue );
 
-		return ::q::make_shared_using_constructor< defer< T... > >(
+		return ::q::make_pooled_shared< defer< T... > >(
 			std::move( std_promise ),
 			std::move( signal ),
 			std::move( q_promise ) );
@@ -593,15 +597,76 @@ protected:
 	, signal_( std::move( signal ) )
 	, deferred_( std::move( deferred ) )
 	, queue_( deferred_.get_queue( ) )
+	// The defer and the value in the std::promise's shared state
+	, accounted_( sizeof( defer< T... > ) + sizeof( expect_type ) )
+	, settled_( false )
 	{ }
 
+	/**
+	 * A defer which is destroyed without being settled would leave its
+	 * promise, and everything waiting for it, pending forever. It's instead
+	 * rejected, so that the continuations run (and are freed).
+	 *
+	 * The defer can be destroyed anywhere, e.g. by a channel pruning its
+	 * waiters with its mutex locked, so the rejection is pushed to the
+	 * defer's queue (if it has one) rather than run inline, where
+	 * synchronous callbacks (see promise::on_settled( )) could re-enter the
+	 * destroying context.
+	 * If that fails (such as when allocating fails), the promise is left
+	 * pending, as a destructor mustn't throw.
+	 */
+	~defer( )
+	{
+		if ( settled_ )
+			return;
+
+		try
+		{
+			abandoned_task reject{
+				std::move( promise_ ), std::move( signal_ ) };
+
+			if ( queue_ )
+				queue_->push( std::move( reject ) );
+			else
+				reject( );
+		}
+		catch ( ... )
+		{ }
+	}
+
 private:
+	/**
+	 * Rejects the promise of an abandoned defer.
+	 */
+	struct abandoned_task
+	{
+		std::promise< expect_type > promise_;
+		promise_signal_ptr signal_;
+
+		void operator( )( ) noexcept
+		{
+			try
+			{
+				promise_.set_value( ::q::refuse< tuple_type >(
+					std::make_exception_ptr(
+						abandoned_promise_exception( ) ) ) );
+				signal_->done( );
+			}
+			catch ( ... )
+			{ }
+		}
+	};
+
 	std::promise< expect_type > promise_;
 	promise_signal_ptr          signal_;
 
 	promise_type                deferred_;
 
 	queue_ptr                   queue_;
+
+	accounted< accounted_object::defer > accounted_;
+
+	bool                        settled_;
 };
 
 template< typename... T >
@@ -609,6 +674,23 @@ class defer< std::tuple< T... > >
 : public defer< T... >
 { };
 
+/**
+ * Creates an already settled promise. This is cheaper than settling a defer,
+ * as the value is set directly in the promise state, and continuations added
+ * to it are pushed to their queues right away.
+ */
+template< typename... T >
+promise< T... >
+make_ready_promise( const queue_ptr& queue, expect< std::tuple< T... > >&& value )
+{
+	typedef promise_state_data< std::tuple< T... >, false > state_data_type;
+	typedef promise_state< std::tuple< T... >, false > state_type;
+
+	state_data_type state_data( std::move( value ) );
+
+	return promise< T... >( state_type( std::move( state_data ) ), queue );
+}
+
 } // namespace detail
 
 } // namespace q
@@ -292,6 +292,118 @@ fail( Fn&& fn, Queue&& queue )
 	return deferred->template get_suitable_promise< promise_this_type >( );
 }
 
+/**
+ * Rethrows an exception once, within nested try blocks, one per handler. The
+ * innermost try block catches the exception type of the first handler, so the
+ * handlers are matched in order. Exceptions thrown by a handler are caught
+ * directly, so they never reach the other handlers.
+ */
+template< std::size_t Index >
+struct fail_dispatcher
+{
+	template< typename Defer, typename Handlers >
+	static void dispatch(
+		Defer& deferred,
+		Handlers& handlers,
+		const std::exception_ptr& e
+	)
+	{
+		typedef typename std::tuple_element< Index - 1, Handlers >::type
+			fn_type;
+		typedef typename std::decay< Q_FIRST_ARGUMENT_OF( fn_type ) >::type
+			exception_type;
+
+		try
+		{
+			fail_dispatcher< Index - 1 >::dispatch(
+				deferred, handlers, e );
+		}
+		catch ( exception_type& ex )
+		{
+			try
+			{
+				deferred.set_by_fun(
+					std::move( std::get< Index - 1 >( handlers ) ),
+					ex );
+			}
+			catch ( ... )
+			{
+				deferred.set_exception( std::current_exception( ) );
+			}
+		}
+	}
+};
+
+template< >
+struct fail_dispatcher< 0 >
+{
+	template< typename Defer, typename Handlers >
+	static void dispatch( Defer&, Handlers&, const std::exception_ptr& e )
+	{
+		std::rethrow_exception( e );
+	}
+};
+
+/**
+ * E1, E2, ... -> tuple< T... > or P< tuple< T... > >
+ */
+template< bool Shared, typename... Args >
+template< typename Fn1, typename Fn2, typename... Fns >
+typename std::enable_if<
+	are_class_fail_handlers< arguments< Args... >, Fn1, Fn2, Fns... >::value,
+	typename generic_promise< Shared, Args... >::promise_this_type
+>::type
+generic_promise< Shared, Args... >::
+fail( Fn1&& fn1, Fn2&& fn2, Fns&&... fns )
+{
+	typedef std::tuple<
+		typename std::decay< Fn1 >::type,
+		typename std::decay< Fn2 >::type,
+		typename std::decay< Fns >::type...
+	> handlers_type;
+
+	auto deferred = detail::defer< Args... >::construct( get_queue( ) );
+	auto state = state_;
+
+	handlers_type handlers(
+		std::forward< Fn1 >( fn1 ),
+		std::forward< Fn2 >( fn2 ),
+		std::forward< Fns >( fns )... );
+	Q_MOVE_INTO_MOVABLE( handlers );
+
+	auto perform = [ deferred, Q_MOVABLE_MOVE( handlers ), state ]( )
+	mutable
+	{
+		auto value = state->consume( );
+		if ( value.has_exception( ) )
+		{
+			auto handlers = Q_MOVABLE_CONSUME( handlers );
+
+			try
+			{
+				fail_dispatcher<
+					std::tuple_size< handlers_type >::value
+				>::dispatch( *deferred, handlers, value.exception( ) );
+			}
+			catch ( ... )
+			{
+				// None of the handlers matched
+				deferred->set_exception(
+					std::current_exception( ) );
+			}
+		}
+		else
+		{
+			// Forward data
+			deferred->set_value( value.consume( ) );
+		}
+	};
+
+	state_->signal( )->push( std::move( perform ), get_queue( ) );
+
+	return deferred->template get_suitable_promise< promise_this_type >( );
+}
+
 } } // namespace detail, namespace q
 
 #endif // LIBQ_PROMISE_PROMISE_IMPL_FAIL_HPP
@@ -50,8 +50,8 @@ typename generic_promise< Shared, Args... >::promise_this_type
 generic_promise< Shared, Args... >::
 delay( timer::duration_type duration, queue_options options )
 {
-	auto queue = options.move< queue_ptr >( queue_ );
-	auto next_queue = options.move< defaultable< queue_ptr > >(
+	auto queue = options.template move< queue_ptr >( queue_ );
+	auto next_queue = options.template move< defaultable< queue_ptr > >(
 		set_default( queue ) ).value;
 
 	auto deferred = ::q::make_shared< detail::defer< Args... > >(
@@ -161,6 +161,25 @@ forward( U&&... values )
 	return deferred->get_promise( );
 }
 
+template< bool Shared, typename... Args >
+template< typename Fn >
+void generic_promise< Shared, Args... >::
+on_settled( Fn&& fn )
+{
+	typename std::decay< Fn >::type settled( std::forward< Fn >( fn ) );
+	Q_MOVE_INTO_MOVABLE( settled );
+
+	auto state = state_;
+
+	auto perform = [ state, Q_MOVABLE_MOVE( settled ) ]( ) mutable
+	{
+		auto fn = Q_MOVABLE_CONSUME( settled );
+		fn( state->consume( ) );
+	};
+
+	state_->signal( )->push_synchronous( std::move( perform ) );
+}
+
 } } // namespace detail, namespace q
 
 namespace q {
@@ -19,6 +19,68 @@
 
 namespace q { namespace detail {
 
+/**
+ * Whether all arguments of Fn are const lvalue references, i.e. whether the
+ * function can be called with the value of a shared promise without copying
+ * it.
+ */
+template< typename Fn >
+struct takes_const_references
+: bool_type_t<
+	( arity_of_t< Fn >::value > 0 )
+	and
+	arguments_of_t< Fn >::template filter< is_const_lvalue_reference >
+		::size::value == arity_of_t< Fn >::value
+>
+{ };
+
+/**
+ * Calls the function of a then( ) continuation with the settled value of the
+ * upstream promise. The value is moved out of the state, unless ByReference
+ * is true, in which case the function gets const references into the (shared)
+ * state.
+ */
+template< bool ByReference >
+struct then_caller
+{
+	template< typename State, typename Defer, typename Fn >
+	static void call( State& state, Defer& deferred, Fn&& fn )
+	{
+		auto value = state.consume( );
+		if ( value.has_exception( ) )
+			// Redirect exception
+			deferred.set_exception( value.exception( ) );
+		else
+			deferred.set_by_fun(
+				std::forward< Fn >( fn ), value.consume( ) );
+	}
+};
+
+template< >
+struct then_caller< true >
+{
+	template< typename State, typename Defer, typename Fn >
+	static void call( State& state, Defer& deferred, Fn&& fn )
+	{
+		const auto& value = state.ref( );
+		if ( value.has_exception( ) )
+			// Redirect exception
+			deferred.set_exception( value.exception( ) );
+		else
+			deferred.set_by_fun(
+				std::forward< Fn >( fn ),
+				const_reference_tuple( value.get( ) ) );
+	}
+
+private:
+	template< typename... T >
+	static std::tuple< const T&... >
+	const_reference_tuple( const std::tuple< T... >& tuple )
+	{
+		return std::tuple< const T&... >( tuple );
+	}
+};
+
 /**
  * ( ... ) -> value
  */
@@ -51,13 +113,9 @@ then( Fn&& fn, Queue&& queue )
 
 	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		then_caller<
+			Shared and takes_const_references< Fn >::value
+		>::call( *state, *deferred, Q_MOVABLE_CONSUME( fn ) );
 	};
 
 	state_->signal( )->push( std::move( perform ),
@@ -146,13 +204,9 @@ then( Fn&& fn, Queue&& queue )
 
 	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		then_caller<
+			Shared and takes_const_references< Fn >::value
+		>::call( *state, *deferred, Q_MOVABLE_CONSUME( fn ) );
 	};
 
 	state_->signal( )->push( std::move( perform ),
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PROMISE_LAZY_HPP
+#define LIBQ_PROMISE_LAZY_HPP
+
+namespace q {
+
+namespace detail {
+
+/**
+ * A function which calls Second with the result of First, or without
+ * arguments if First returns void. Like for then( ), a tuple result is
+ * unpacked into separate arguments, unless Second takes the tuple itself.
+ */
+template< typename First, typename Second >
+class composed_function
+{
+public:
+	typedef result_of_t< Second > result_type;
+
+	composed_function( First&& first, Second&& second )
+	: first_( std::move( first ) )
+	, second_( std::move( second ) )
+	{ }
+
+	result_type operator( )( )
+	{
+		typedef result_of_t< First > first_result;
+
+		return call(
+			std::is_void< first_result >( ),
+			bool_type_t<
+				is_tuple< typename std::decay< first_result >::type >::value
+				and
+				!first_argument_is_tuple< Second >::value
+			>( )
+		);
+	}
+
+private:
+	template< typename Unpack >
+	result_type call( std::true_type, Unpack )
+	{
+		first_( );
+		return second_( );
+	}
+
+	result_type call( std::false_type, std::false_type )
+	{
+		return second_( first_( ) );
+	}
+
+	result_type call( std::false_type, std::true_type )
+	{
+		return call_with_args_by_tuple( second_, first_( ) );
+	}
+
+	First first_;
+	Second second_;
+};
+
+} // namespace detail
+
+/**
+ * A lazy promise is a chain of functions which isn't scheduled until it is
+ * started. All functions added with then( ) are fused into one function, so
+ * the whole chain runs as one task on the queue, with one promise created
+ * for its result, rather than one task and one promise per step.
+ *
+ * Each function is called with the result of the previous one (or without
+ * arguments if it returned void), where a returned tuple is unpacked into
+ * separate arguments, as with then( ). Steps can't return promises, as
+ * awaiting them can't be fused; there is no awaiting then( ) on a lazy
+ * promise, so continue with then( ) on the promise returned by start( ).
+ * An exception thrown by any step skips the rest of the chain and rejects
+ * the started promise.
+ */
+template< typename Fn >
+class lazy_promise
+{
+	static_assert( arity_of_t< Fn >::value == 0,
+		"The first function of a lazy promise can't take arguments" );
+	static_assert( !is_promise< result_of_t< Fn > >::value,
+		"The functions of a lazy promise can't return promises" );
+
+public:
+	typedef decltype( make_promise(
+		std::declval< const queue_ptr& >( ), std::declval< Fn >( ) )
+	) promise_type;
+
+	lazy_promise( const queue_ptr& queue, Fn&& fn )
+	: queue_( queue )
+	, fn_( std::move( fn ) )
+	{ }
+
+	lazy_promise( lazy_promise&& ) = default;
+	lazy_promise( const lazy_promise& ) = delete;
+
+	/**
+	 * Appends a function to the chain. This consumes the lazy promise.
+	 */
+	template< typename Next >
+	lazy_promise< detail::composed_function<
+		Fn, typename std::decay< Next >::type
+	> >
+	then( Next&& next )
+	{
+		typedef typename std::decay< Next >::type next_type;
+		typedef detail::composed_function< Fn, next_type > composed_type;
+
+		return lazy_promise< composed_type >( queue_, composed_type(
+			std::move( fn_ ), next_type( std::forward< Next >( next ) ) ) );
+	}
+
+	/**
+	 * Schedules the chain as one task on the queue, and returns a promise
+	 * of its result. This consumes the lazy promise.
+	 */
+	promise_type start( )
+	{
+		return make_promise( queue_, std::move( fn_ ) );
+	}
+
+private:
+	queue_ptr queue_;
+	Fn fn_;
+};
+
+/**
+ * Creates a lazy promise starting with fn, which will run on queue.
+ *
+ * @see lazy_promise
+ */
+template< typename Fn >
+lazy_promise< typename std::decay< Fn >::type >
+lazy( const queue_ptr& queue, Fn&& fn )
+{
+	typedef typename std::decay< Fn >::type fn_type;
+
+	return lazy_promise< fn_type >( queue, fn_type( std::forward< Fn >( fn ) ) );
+}
+
+} // namespace q
+
+#endif // LIBQ_PROMISE_LAZY_HPP
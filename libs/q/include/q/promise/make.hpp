@@ -19,6 +19,12 @@
 
 namespace q {
 
+/**
+ * Resolves the promise created by make_promise. Copies of the resolver (and
+ * rejecter) refer to the same promise. If all copies are destroyed without
+ * the promise being settled, it is rejected with an
+ * abandoned_promise_exception.
+ */
 template< typename... Args >
 struct resolver
 {
@@ -43,6 +49,11 @@ private:
 	std::shared_ptr< ::q::detail::defer< Args... > > deferred_;
 };
 
+/**
+ * Rejects the promise created by make_promise.
+ *
+ * @see resolver
+ */
 template< typename... Args >
 struct rejecter
 {
@@ -52,6 +52,59 @@ struct suitable_promise< std::tuple< Args... > >
 template< typename... Args >
 using suitable_promise_t = typename suitable_promise< Args... >::type;
 
+template<
+	typename Arguments,
+	typename Result,
+	bool IsPromise = ::q::is_promise< Result >::value
+>
+struct is_fail_result_convertible
+: tuple_arguments_t< Result >::template is_convertible_to< Arguments >
+{ };
+
+template< typename Arguments, typename Result >
+struct is_fail_result_convertible< Arguments, Result, true >
+: Result::argument_types::template is_convertible_to< Arguments >
+{ };
+
+/**
+ * Whether Fn is a class-matching fail( ) handler for a promise of Arguments,
+ * i.e. takes an exception E (not an std::exception_ptr) and returns either the
+ * values or a promise of the values.
+ */
+template<
+	typename Arguments,
+	typename Fn,
+	bool IsFunction = is_function_t< Fn >::value
+>
+struct is_class_fail_handler
+: std::false_type
+{ };
+
+template< typename Arguments, typename Fn >
+struct is_class_fail_handler< Arguments, Fn, true >
+: bool_type_t<
+	arity_of_t< Fn >::value == 1
+	and
+	!arguments_of_are_t< Fn, std::exception_ptr >::value
+	and
+	is_fail_result_convertible< Arguments, result_of_t< Fn > >::value
+>
+{ };
+
+template< typename Arguments, typename... Fns >
+struct are_class_fail_handlers
+: std::true_type
+{ };
+
+template< typename Arguments, typename Fn, typename... Fns >
+struct are_class_fail_handlers< Arguments, Fn, Fns... >
+: bool_type_t<
+	is_class_fail_handler< Arguments, Fn >::value
+	and
+	are_class_fail_handlers< Arguments, Fns... >::value
+>
+{ };
+
 template< bool Shared, typename... Args >
 class generic_promise
 {
@@ -378,6 +431,24 @@ public:
 	>::type
 	fail( Fn&& fn, Queue&& queue = nullptr );
 
+	/**
+	 * E1, E2, ... -> tuple< T... > or P< tuple< T... > >
+	 *
+	 * Multiple class-matching handlers, merged into one fail( ). The
+	 * exception is rethrown only once and matched against the handlers'
+	 * exception types in order, like the catch clauses of one try block,
+	 * while fail( fa ).fail( fb ).fail( fc ) rethrows it once per handler.
+	 *
+	 * Unlike such a chain, an exception thrown by a handler is not matched
+	 * against the other handlers, but rejects the resulting promise.
+	 */
+	template< typename Fn1, typename Fn2, typename... Fns >
+	typename std::enable_if<
+		are_class_fail_handlers< argument_types, Fn1, Fn2, Fns... >::value,
+		promise_this_type
+	>::type
+	fail( Fn1&& fn1, Fn2&& fn2, Fns&&... fns );
+
 	/**
 	 * tap() works like then() in that it will only be called if the
 	 * promise has a value, not exception.
@@ -667,6 +738,23 @@ public:
 	>::type
 	forward( U&&... values );
 
+	/**
+	 * The most primitive continuation, which doesn't create a new promise.
+	 * When this promise is settled, fn is called with the settled value as
+	 * a q::expect of the tuple of values.
+	 *
+	 * fn is called synchronously, in the context which settles the promise
+	 * (or directly, if the promise is already settled), so it must be tiny,
+	 * fast and must not throw. This is used by the combinators, e.g.
+	 * q::all( ), which only need to store the result somewhere.
+	 *
+	 * Continuations keep the order they were added in: fn is called after
+	 * the continuations added before it (e.g. with then( )) have been
+	 * pushed to their queues, and before the ones added after it.
+	 */
+	template< typename Fn >
+	void on_settled( Fn&& fn );
+
 	void done( )
 	{
 		// TODO: Implement
@@ -749,6 +837,12 @@ public:
 	::q::promise< > strip( );
 };
 
+/**
+ * A promise which can have several continuations. Each continuation gets its
+ * own copy of the value, except for continuations which only take const
+ * references (e.g. `( const std::string& )`); they all read the value from the
+ * shared state, so fanning out a large value doesn't copy it.
+ */
 template< typename... T >
 class shared_promise
 : public detail::generic_promise< true, T... >
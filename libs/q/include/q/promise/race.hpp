@@ -0,0 +1,322 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PROMISE_RACE_HPP
+#define LIBQ_PROMISE_RACE_HPP
+
+#include <q/promise/all.hpp>
+#include <q/mutex.hpp>
+
+namespace q {
+
+namespace detail {
+
+/**
+ * The shared state of q::race( ). The first promise to settle claims the
+ * state and settles the resulting promise, the rest are dropped.
+ */
+template< typename Tuple >
+class race_state
+: public std::enable_shared_from_this< race_state< Tuple > >
+{
+public:
+	typedef typename tuple_arguments_t< Tuple >
+		::template apply< defer > defer_type;
+
+	race_state( const queue_ptr& queue )
+	: deferred_( ::q::make_shared< defer_type >( queue ) )
+	, settled_( false )
+	{ }
+
+	typename defer_type::promise_type get_promise( )
+	{
+		return deferred_->get_promise( );
+	}
+
+	template< typename Promise >
+	void add( Promise& promise )
+	{
+		auto self = this->shared_from_this( );
+
+		promise.on_settled( [ self ]( expect< Tuple >&& exp )
+		{
+			self->settle( std::move( exp ) );
+		} );
+	}
+
+	void reject( std::exception_ptr&& e )
+	{
+		if ( settled_.exchange( true, std::memory_order_acq_rel ) )
+			return;
+
+		auto deferred = std::move( deferred_ );
+		deferred->set_exception( e );
+	}
+
+private:
+	void settle( expect< Tuple >&& exp )
+	{
+		if ( settled_.exchange( true, std::memory_order_acq_rel ) )
+			// Lost the race, the result is dropped
+			return;
+
+		// Only the winner ever reaches this, so the deferred can be
+		// released without locking
+		auto deferred = std::move( deferred_ );
+		deferred->set_expect( std::move( exp ) );
+	}
+
+	std::shared_ptr< defer_type > deferred_;
+	std::atomic< bool > settled_;
+};
+
+/**
+ * The shared state of q::any( ) (when Single is true) and q::some( ). It is
+ * settled when enough promises have been fulfilled, or when too many have
+ * been rejected for that to ever happen. Promises settling after that are
+ * dropped.
+ */
+template< typename Tuple, bool Single >
+class some_state
+: public std::enable_shared_from_this< some_state< Tuple, Single > >
+{
+public:
+	typedef all_element< Tuple >                   element;
+	typedef typename element::element_type         element_type;
+	typedef typename std::conditional<
+		Single,
+		typename tuple_arguments_t< Tuple >
+			::template apply< defer >,
+		typename element::defer_type
+	>::type                                        defer_type;
+	typedef combined_promise_exception< element_type > exception_type;
+
+	some_state( std::size_t num, std::size_t needed, const queue_ptr& queue )
+	: deferred_( ::q::make_shared< defer_type >( queue ) )
+	, mutex_( Q_HERE, "some_state" )
+	, needed_( needed )
+	, allowed_failures_( needed > num ? 0 : num - needed + 1 )
+	{ }
+
+	typename defer_type::promise_type get_promise( )
+	{
+		return deferred_->get_promise( );
+	}
+
+	template< typename Promise >
+	void add( Promise& promise )
+	{
+		auto self = this->shared_from_this( );
+
+		promise.on_settled( [ self ]( expect< Tuple >&& exp )
+		{
+			self->settle( std::move( exp ) );
+		} );
+	}
+
+	/**
+	 * Settles the resulting promise directly if the outcome is given
+	 * already, i.e. if nothing or too much is needed.
+	 */
+	void settle_trivial( )
+	{
+		if ( needed_ == 0 || allowed_failures_ == 0 )
+		{
+			// Released, so that the promises settling later are
+			// dropped rather than completing it again
+			auto deferred = std::move( deferred_ );
+			complete( std::move( deferred ) );
+		}
+	}
+
+private:
+	void settle( expect< Tuple >&& exp )
+	{
+		std::shared_ptr< defer_type > deferred;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( !deferred_ )
+				// Already settled, the result is dropped
+				return;
+
+			if ( exp.has_exception( ) )
+			{
+				failed_.push_back(
+					element::make_expect( std::move( exp ) ) );
+
+				if ( failed_.size( ) < allowed_failures_ )
+					return;
+			}
+			else
+			{
+				fulfilled_.push_back( std::move( exp ) );
+
+				if ( fulfilled_.size( ) < needed_ )
+					return;
+			}
+
+			deferred = std::move( deferred_ );
+		}
+
+		// The state can't change anymore when the deferred is claimed
+		complete( std::move( deferred ) );
+	}
+
+	void complete( std::shared_ptr< defer_type >&& deferred )
+	{
+		if ( fulfilled_.size( ) < needed_ )
+			deferred->set_exception(
+				std::make_exception_ptr(
+					exception_type( std::move( failed_ ) ) ) );
+		else
+			resolve( *deferred, bool_type_t< Single >( ) );
+	}
+
+	void resolve( defer_type& deferred, std::true_type )
+	{
+		deferred.set_expect( std::move( fulfilled_.front( ) ) );
+	}
+
+	void resolve( defer_type& deferred, std::false_type )
+	{
+		std::vector< expect< element_type > > data;
+		data.reserve( fulfilled_.size( ) );
+
+		for ( auto& exp : fulfilled_ )
+			data.push_back( element::make_expect( std::move( exp ) ) );
+
+		element::set_value( deferred, data );
+	}
+
+	std::shared_ptr< defer_type > deferred_;
+	mutex mutex_;
+	const std::size_t needed_;
+	const std::size_t allowed_failures_;
+	std::vector< expect< Tuple > > fulfilled_;
+	std::vector< expect< element_type > > failed_;
+};
+
+} // namespace detail
+
+/**
+ * Settles to the value or the exception of the first promise in the list to
+ * be settled. The other promises' results are dropped when they settle, without
+ * scheduling any further work.
+ *
+ * An empty list results in a rejected promise (with an empty
+ * q::combined_promise_exception), as nothing would ever settle it.
+ */
+template< typename List >
+typename std::enable_if<
+	is_vector< typename std::decay< List >::type >::value &&
+	is_promise< typename std::decay< List >::type::value_type >::value,
+	detail::suitable_promise_t<
+		typename std::decay< List >::type::value_type::tuple_type
+	>
+>::type
+race( List&& list, const queue_ptr& queue )
+{
+	typedef typename std::decay< List >::type::value_type::tuple_type
+		tuple_type;
+	typedef typename detail::all_element< tuple_type >::element_type
+		element_type;
+	typedef std::vector< expect< element_type > > expect_list_type;
+
+	auto state = ::q::make_shared< detail::race_state< tuple_type > >(
+		queue );
+	auto promise = state->get_promise( );
+
+	if ( list.empty( ) )
+		state->reject( std::make_exception_ptr(
+			combined_promise_exception< element_type >(
+				expect_list_type( ) ) ) );
+
+	for ( auto& element : list )
+		state->add( element );
+
+	return promise;
+}
+
+/**
+ * Resolves to the value of the first promise in the list to be fulfilled.
+ * If all promises are rejected, the resulting promise is rejected with a
+ * q::combined_promise_exception of all the exceptions. The other promises'
+ * results are dropped when they settle, without scheduling any further work.
+ */
+template< typename List >
+typename std::enable_if<
+	is_vector< typename std::decay< List >::type >::value &&
+	is_promise< typename std::decay< List >::type::value_type >::value,
+	detail::suitable_promise_t<
+		typename std::decay< List >::type::value_type::tuple_type
+	>
+>::type
+any( List&& list, const queue_ptr& queue )
+{
+	typedef typename std::decay< List >::type::value_type::tuple_type
+		tuple_type;
+
+	auto state = ::q::make_shared< detail::some_state< tuple_type, true > >(
+		list.size( ), 1, queue );
+	auto promise = state->get_promise( );
+
+	state->settle_trivial( );
+
+	for ( auto& element : list )
+		state->add( element );
+
+	return promise;
+}
+
+/**
+ * Resolves to a std::vector of the values of the first `count` promises in
+ * the list to be fulfilled, in the order they were fulfilled. The vector is of
+ * the same type as for q::all( ).
+ *
+ * If so many promises are rejected that `count` promises can't be fulfilled,
+ * the resulting promise is rejected with a q::combined_promise_exception of
+ * the exceptions so far.
+ */
+template< typename List >
+typename std::enable_if<
+	is_vector< typename std::decay< List >::type >::value &&
+	is_promise< typename std::decay< List >::type::value_type >::value,
+	detail::suitable_promise_t<
+		typename detail::all_return_type< List >::tuple_type
+	>
+>::type
+some( std::size_t count, List&& list, const queue_ptr& queue )
+{
+	typedef typename std::decay< List >::type::value_type::tuple_type
+		tuple_type;
+
+	auto state = ::q::make_shared< detail::some_state< tuple_type, false > >(
+		list.size( ), count, queue );
+	auto promise = state->get_promise( );
+
+	state->settle_trivial( );
+
+	for ( auto& element : list )
+		state->add( element );
+
+	return promise;
+}
+
+} // namespace q
+
+#endif // LIBQ_PROMISE_RACE_HPP
@@ -35,13 +35,10 @@ typename std::enable_if<
 >::type
 reject( const queue_ptr& queue, E&& e )
 {
-	typedef detail::defer< Arguments... > defer_type;
+	typedef std::tuple< Arguments... > tuple_type;
 
-	auto deferred = ::q::make_shared< defer_type >( queue );
-
-	deferred->set_exception( std::forward< E >( e ) );
-
-	return deferred->get_promise( );
+	return detail::make_ready_promise( queue,
+		::q::refuse< tuple_type >( std::forward< E >( e ) ) );
 }
 
 template< typename... Arguments, typename E >
@@ -51,14 +48,10 @@ typename std::enable_if<
 >::type
 reject( const queue_ptr& queue, E&& e )
 {
-	typedef detail::defer< Arguments... > defer_type;
-
-	auto deferred = ::q::make_shared< defer_type >( queue );
-
-	deferred->set_exception(
-		std::make_exception_ptr( std::forward< E >( e ) ) );
+	typedef std::tuple< Arguments... > tuple_type;
 
-	return deferred->get_promise( );
+	return detail::make_ready_promise( queue, ::q::refuse< tuple_type >(
+		std::make_exception_ptr( std::forward< E >( e ) ) ) );
 }
 
 } // namespace q
@@ -23,6 +23,10 @@
 
 namespace q { namespace detail {
 
+class promise_signal;
+
+typedef std::shared_ptr< promise_signal > promise_signal_ptr;
+
 // TODO: Make lock-free with a lock-free queue and atomic bool.
 class promise_signal
 : public std::enable_shared_from_this< promise_signal >
@@ -35,17 +39,25 @@ public:
 	void push( task&& task, const queue_ptr& queue ) noexcept;
 	void push_synchronous( task&& task ) noexcept;
 
+	/**
+	 * The signal of promises which are settled when created. A done signal
+	 * holds no state, so one is shared by all of them, and tasks are
+	 * pushed through it without locking.
+	 */
+	static const promise_signal_ptr& ready( ) noexcept;
+
 protected:
 	promise_signal( );
 
+	explicit promise_signal( bool ready );
+
 private:
 	struct pimpl;
 
 	std::unique_ptr< pimpl > pimpl_;
+	const bool ready_;
 };
 
-typedef std::shared_ptr< promise_signal > promise_signal_ptr;
-
 } } // namespace detail, namespace queue
 
 #endif // LIBQ_PROMISE_SIGNAL_HPP
@@ -37,11 +37,29 @@ struct promise_state_data
 
 	promise_state_data( future_type&& future )
 	: future( std::move( future ) )
-	, signal( make_shared< promise_signal >( ) )
+	, signal( make_pooled_shared< promise_signal >( ) )
+	{ }
+
+	/**
+	 * Constructs the state of an already settled promise, without any
+	 * std::promise or q::defer outliving the construction.
+	 */
+	promise_state_data( value_type&& value )
+	: future( make_ready_future( std::move( value ) ) )
+	, signal( promise_signal::ready( ) )
 	{ }
 
 	future_type future;
 	promise_signal_ptr signal;
+
+private:
+	static future_type make_ready_future( value_type&& value )
+	{
+		std::promise< value_type > std_promise(
+			std::allocator_arg, pool_allocator< value_type >( ) );
+		std_promise.set_value( std::move( value ) );
+		return std_promise.get_future( );
+	}
 };
 
 template< typename T >
@@ -78,6 +96,15 @@ public:
 		return data_->future.get( );
 	}
 
+	/**
+	 * The settled value, without copying it. Every continuation reads the
+	 * same value, so it must not be modified.
+	 */
+	const typename state_type::value_type& ref( ) const
+	{
+		return data_->future.get( );
+	}
+
 	promise_signal_ptr signal( )
 	{
 		return data_->signal;
@@ -90,7 +117,8 @@ public:
 
 protected:
 	shared_state( promise_state_data< T, false >&& data )
-	: data_( std::make_shared< state_type >( std::move( data ) ) )
+	: data_( std::allocate_shared< state_type >(
+		pool_allocator< state_type >( ), std::move( data ) ) )
 	{ }
 
 private:
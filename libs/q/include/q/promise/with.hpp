@@ -32,14 +32,10 @@ promise<
 >
 with( const queue_ptr& queue, T&&... t )
 {
-	typedef detail::defer<
-		typename std::decay< T >::type...
-	> defer_type;
-	auto deferred = ::q::make_shared< defer_type >( queue );
+	typedef std::tuple< typename std::decay< T >::type... > tuple_type;
 
-	deferred->set_value( std::forward_as_tuple( std::forward< T >( t )... ) );
-
-	return deferred->get_promise( );
+	return detail::make_ready_promise( queue, ::q::fulfill< tuple_type >(
+		tuple_type( std::forward< T >( t )... ) ) );
 }
 
 /**
@@ -52,13 +48,10 @@ typename std::enable_if<
 >::type
 with( const queue_ptr& queue, Tuple&& t )
 {
-	typedef typename tuple_arguments_t< typename std::decay< Tuple >::type >
-		::template apply< detail::defer > defer_type;
-	auto deferred = ::q::make_shared< defer_type >( queue );
-
-	deferred->set_value( std::forward< Tuple >( t ) );
+	typedef typename std::decay< Tuple >::type tuple_type;
 
-	return deferred->get_promise( );
+	return detail::make_ready_promise( queue, ::q::fulfill< tuple_type >(
+		tuple_type( std::forward< Tuple >( t ) ) ) );
 }
 
 /**
@@ -21,11 +21,14 @@
 #include <q/mutex.hpp>
 #include <q/exception.hpp>
 #include <q/timer.hpp>
+#include <q/accounting.hpp>
 
 #include <memory>
 
 namespace q {
 
+class basic_event_dispatcher;
+
 class queue_exception
 : public exception
 { };
@@ -88,6 +91,15 @@ public:
 	void push( task&& task );
 	void push( task&& task, timer::point_type wait_until );
 
+	/**
+	 * Pushes count tasks (moved from tasks) at once, with one lock of the
+	 * queue. A consumer function is notified once per task, as with push( ).
+	 * An event dispatcher is notified at most as many times as its
+	 * parallelism, as its woken up workers continue with the rest of the
+	 * tasks.
+	 */
+	void push_batch( task* tasks, std::size_t count );
+
 	priority_t priority( ) const;
 
 	/**
@@ -96,12 +108,37 @@ public:
 	 */
 	void set_consumer( notify_type fn, std::size_t parallelism );
 
+	/**
+	 * Sets an event dispatcher as consumer of the queue, which is notified
+	 * each time a task is added to the queue. Unlike a consumer function,
+	 * no reference to the dispatcher is held or taken when notifying it.
+	 *
+	 * The queue only holds a raw pointer to the dispatcher, so it must be
+	 * removed with remove_consumer( ) before the dispatcher is destructed.
+	 * Schedulers do this in their unloader, which every dispatcher,
+	 * including custom ones, must call before it dies (see
+	 * basic_event_dispatcher::set_unloader).
+	 */
+	void set_consumer( basic_event_dispatcher* dispatcher );
+
+	/**
+	 * Removes the consumer, and waits for ongoing notifications of it to
+	 * complete, so that it won't be called after this returns. This must
+	 * not be called from within such a notification.
+	 */
+	void remove_consumer( );
+
 	bool empty( );
 
 	timer_task pop( );
 
 	std::size_t parallelism( ) const;
 
+	/**
+	 * Returns the number of queued tasks, and the memory used for them.
+	 */
+	queue_accounting accounting( );
+
 protected:
 	queue( priority_t priority = 0 );
 
@@ -0,0 +1,356 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_SELECT_HPP
+#define LIBQ_SELECT_HPP
+
+#include <q/channel.hpp>
+
+#include <vector>
+#include <atomic>
+
+namespace q {
+
+namespace detail {
+
+/**
+ * The state shared by all waiters registered by one call to
+ * selector::select( ). The first channel to claim it gets to deliver its
+ * value, all other waiters are dropped by their channels when they are
+ * reached.
+ */
+class select_state
+{
+public:
+	select_state(
+		std::shared_ptr< detail::defer< bool > > deferred,
+		std::size_t open
+	)
+	: deferred_( std::move( deferred ) )
+	, claimed_( false )
+	, open_( open )
+	{ }
+
+	bool claim( )
+	{
+		bool expected = false;
+		return claimed_.compare_exchange_strong( expected, true );
+	}
+
+	bool is_claimed( ) const
+	{
+		return claimed_.load( std::memory_order_acquire );
+	}
+
+	/**
+	 * One of the channels is closed. Only when all channels are closed
+	 * is the select resolved (with false).
+	 */
+	void set_closed( )
+	{
+		if ( --open_ == 0 && claim( ) )
+			deferred_->set_value( std::make_tuple( false ) );
+	}
+
+	void set_exception( std::exception_ptr e )
+	{
+		if ( claim( ) )
+			deferred_->set_exception( std::move( e ) );
+	}
+
+	const std::shared_ptr< detail::defer< bool > >& get_deferred( ) const
+	{
+		return deferred_;
+	}
+
+private:
+	std::shared_ptr< detail::defer< bool > > deferred_;
+	std::atomic< bool > claimed_;
+	std::atomic< std::size_t > open_;
+};
+
+template< typename Fn, typename... T >
+class select_waiter
+: public shared_channel< T... >::waiter_type
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+
+	select_waiter( Fn fn, std::shared_ptr< select_state > state )
+	: fn_( std::move( fn ) )
+	, state_( std::move( state ) )
+	{ }
+
+	bool claim( ) override
+	{
+		return state_->claim( );
+	}
+
+	bool is_abandoned( ) const override
+	{
+		return state_->is_claimed( );
+	}
+
+	void set_closed( ) override
+	{
+		state_->set_closed( );
+	}
+
+	void set_exception( std::exception_ptr e ) override
+	{
+		state_->set_exception( std::move( e ) );
+	}
+
+	void set_value( tuple_type&& t ) override
+	{
+		auto deferred = state_->get_deferred( );
+		auto queue = deferred->get_queue( );
+
+		auto proxy = ::q::make_shared< detail::defer< > >( queue );
+
+		auto fn_value = std::move( fn_ );
+		Q_MOVE_INTO_MOVABLE( fn_value );
+		Q_MOVE_INTO_MOVABLE( t );
+
+		auto fn =
+		[
+			proxy,
+			Q_MOVABLE_MOVE( fn_value ),
+			Q_MOVABLE_MOVE( t )
+		]
+		( ) mutable
+		{
+			proxy->set_by_fun(
+				Q_MOVABLE_CONSUME( fn_value ),
+				Q_MOVABLE_CONSUME( t )
+			);
+		};
+
+		queue->push( std::move( fn ) );
+
+		deferred->satisfy(
+			proxy->get_promise( )
+			.then( [ ]( ) { return true; } )
+		);
+	}
+
+private:
+	Fn fn_;
+	std::shared_ptr< select_state > state_;
+};
+
+} // namespace detail
+
+/**
+ * A selector waits for the first value from any of a set of readables, and
+ * calls the handler registered for that readable with the value.
+ *
+ * Only one waiter is registered per readable for each select( ), and as soon
+ * as one of the readables delivers a value, the waiters in the other
+ * readables are abandoned, so no other value is consumed. Readables which
+ * already have values buffered are tried in a round-robin order between
+ * subsequent calls to select( ), so a busy readable cannot starve the others.
+ *
+ * A selector is not thread safe, it is meant to be used by one consumer.
+ */
+class selector
+{
+public:
+	selector( const queue_ptr& queue )
+	: queue_( queue )
+	, next_( 0 )
+	{ }
+
+	/**
+	 * Adds a readable and a handler to call with values from it. The
+	 * handler may return a promise, in which case the select( ) will
+	 * resolve when this promise resolves.
+	 */
+	template< typename Fn, typename... T >
+	typename std::enable_if<
+		detail::shared_channel< T... >
+			::template fast_waiter_type_traits<
+				decayed_function_t< Fn >,
+				function< void( ) >
+			>
+			::inner_callbacks_are_valid::value
+		and
+		!readable< T... >::is_promise::value,
+		selector&
+	>::type
+	add( readable< T... > r, Fn&& fn )
+	{
+		typedef decayed_function_t< Fn > fn_type;
+		typedef detail::select_waiter< fn_type, T... > waiter_type;
+
+		auto _fn = decay_function( std::forward< Fn >( fn ) );
+		auto ch = r.shared_channel_;
+
+		cases_.push_back(
+			[ ch, _fn ]( const std::shared_ptr< detail::select_state >& state )
+			{
+				ch->add_waiter(
+					::q::make_unique< waiter_type >( _fn, state ) );
+			}
+		);
+
+		return *this;
+	}
+
+	Q_NODISCARD
+	std::size_t size( ) const
+	{
+		return cases_.size( );
+	}
+
+	/**
+	 * Waits for the first value from any of the readables and calls its
+	 * handler.
+	 *
+	 * The returned promise resolves to true when a handler has been called
+	 * (and completed), or false if all readables are closed. If any
+	 * readable is closed with an exception, or a handler fails, the
+	 * promise is rejected with this exception.
+	 */
+	Q_NODISCARD
+	promise< bool > select( )
+	{
+		if ( cases_.empty( ) )
+			return q::with( queue_, false );
+
+		auto deferred = ::q::make_shared< detail::defer< bool > >( queue_ );
+		auto state = std::make_shared< detail::select_state >(
+			deferred, cases_.size( ) );
+
+		const std::size_t size = cases_.size( );
+		const std::size_t start = next_;
+		next_ = ( next_ + 1 ) % size;
+
+		for ( std::size_t i = 0; i < size; ++i )
+		{
+			if ( state->is_claimed( ) )
+				break;
+
+			cases_[ ( start + i ) % size ]( state );
+		}
+
+		return deferred->get_promise( );
+	}
+
+	/**
+	 * Calls select( ) until all readables are closed. The returned promise
+	 * resolves when they are, or is rejected on the first error.
+	 */
+	Q_NODISCARD
+	promise< > consume( )
+	{
+		auto self = std::make_shared< selector >( *this );
+
+		auto cb = [ self ]( resolver< > resolve, rejecter< > reject )
+		{
+			typedef function< promise< >( ) > recurser_type;
+			auto recurser = std::make_shared< recurser_type >( );
+
+			auto failer =
+				[ recurser, reject ]
+				( std::exception_ptr err )
+				mutable
+			{
+				( *recurser ) = recurser_type( );
+				reject( std::move( err ) );
+			};
+
+			auto recurser_fn =
+				[ self, recurser, resolve, failer ]
+				( )
+				mutable
+			{
+				return self->select( )
+				.then( [ self, recurser, resolve ]( bool got_data )
+				mutable
+				{
+					if ( got_data )
+						return ( *recurser )( );
+
+					( *recurser ) = recurser_type( );
+					resolve( );
+
+					return q::with( self->queue_ );
+				} )
+				.fail( failer );
+			};
+
+			*recurser = std::move( recurser_fn );
+
+			ignore_result( ( *recurser )( ) );
+		};
+
+		return q::make_promise( queue_, std::move( cb ) );
+	}
+
+	const queue_ptr& get_queue( ) const
+	{
+		return queue_;
+	}
+
+private:
+	typedef function<
+		void( const std::shared_ptr< detail::select_state >& )
+	> case_type;
+
+	queue_ptr queue_;
+	std::vector< case_type > cases_;
+	std::size_t next_;
+};
+
+namespace detail {
+
+template< typename Fn >
+void merge_into( selector&, const Fn& )
+{ }
+
+template< typename Fn, typename Readable, typename... Rest >
+void merge_into( selector& sel, const Fn& fn, Readable&& r, Rest&&... rest )
+{
+	sel.add( std::forward< Readable >( r ), fn );
+	merge_into( sel, fn, std::forward< Rest >( rest )... );
+}
+
+} // namespace detail
+
+/**
+ * Merges a set of readables into one selector, where all values are handled by
+ * the same function. The selector uses the queue of the first readable.
+ *
+ * Use consume( ) on the returned selector to handle values until all
+ * readables are closed.
+ */
+template< typename Fn, typename... T, typename... Rest >
+selector merge_readables( Fn&& fn, readable< T... > first, Rest&&... rest )
+{
+	selector sel( first.get_queue( ) );
+
+	auto _fn = decay_function( std::forward< Fn >( fn ) );
+
+	detail::merge_into( sel, _fn, std::move( first ),
+		std::forward< Rest >( rest )... );
+
+	return sel;
+}
+
+} // namespace q
+
+#endif // LIBQ_SELECT_HPP
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_SPILL_HPP
+#define LIBQ_SPILL_HPP
+
+#include <q/channel.hpp>
+
+#include <string>
+#include <memory>
+
+namespace q {
+
+Q_MAKE_SIMPLE_EXCEPTION( spill_file_exception );
+
+/**
+ * An append-only file of length-prefixed records, which are read back in the
+ * order they were appended. When all records have been read, the file is
+ * truncated. If it's never fully drained, the unread records are moved to a
+ * new file once at least compact_threshold bytes have been read, and more has
+ * been read than is left to read, so the file doesn't grow beyond roughly
+ * twice the largest backlog (or the threshold).
+ *
+ * This class is not thread safe.
+ */
+class spill_file
+{
+public:
+	/**
+	 * Creates (or truncates) the file at path. The file is removed when
+	 * the spill_file is destructed. While compacting, a temporary file is
+	 * created next to it, with ".compact" appended to the path.
+	 */
+	spill_file(
+		const std::string& path,
+		std::size_t compact_threshold = 1024 * 1024 );
+	~spill_file( );
+
+	spill_file( const spill_file& ) = delete;
+	spill_file& operator=( const spill_file& ) = delete;
+
+	void append( const std::string& record );
+
+	/**
+	 * Reads the next record. Returns false if there are no more records.
+	 */
+	bool read( std::string& record );
+
+	/**
+	 * The number of records appended but not yet read.
+	 */
+	std::size_t size( ) const;
+
+	bool empty( ) const
+	{
+		return size( ) == 0;
+	}
+
+private:
+	struct pimpl;
+	std::unique_ptr< pimpl > pimpl_;
+};
+
+/**
+ * A spilling_writable writes to a writable as long as the channel accepts
+ * more data. When the channel is full, values are instead serialized to a
+ * spill file, and written to the channel in order when the channel resumes.
+ * A writer can thereby write as fast as it wants with bounded memory, at
+ * the cost of sequential disk I/O for the overflow.
+ *
+ * Once values have been spilled, all new values are spilled too until the
+ * spill file is drained, so the order is always kept.
+ *
+ * The serializer turns the values into a record (a byte string), and the
+ * deserializer turns the record back into a tuple of values.
+ */
+template< typename... T >
+class spilling_writable
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+	typedef q::function< std::string( const T&... ) > serializer_type;
+	typedef q::function< tuple_type( const std::string& ) >
+		deserializer_type;
+
+	spilling_writable(
+		writable< T... > writable,
+		const std::string& path,
+		serializer_type serializer,
+		deserializer_type deserializer
+	)
+	: state_( q::make_shared< state >(
+		std::move( writable ),
+		path,
+		std::move( serializer ),
+		std::move( deserializer ) ) )
+	{
+		std::weak_ptr< state > weak_state = state_;
+		auto queue = state_->writable_.get_queue( );
+
+		// The notification can be called with the channel locked, so
+		// the draining is scheduled rather than performed here.
+		state_->writable_.set_resume_notification( [ weak_state, queue ]( )
+		{
+			queue->push( [ weak_state ]( )
+			{
+				auto state = weak_state.lock( );
+				if ( state )
+					state->drain( );
+			} );
+		} );
+	}
+
+	/**
+	 * Writes the values to the channel, or spills them to disk if the
+	 * channel is full. Returns false if the channel is closed.
+	 */
+	template< typename... Args >
+	Q_NODISCARD
+	typename std::enable_if<
+		arguments<
+			typename std::decay< Args >::type...
+		>::template is_convertible_to< arguments< T... > >::value,
+		bool
+	>::type
+	write( Args&&... args )
+	{
+		return state_->write(
+			tuple_type( std::forward< Args >( args )... ) );
+	}
+
+	/**
+	 * The number of values currently spilled to disk.
+	 */
+	Q_NODISCARD
+	std::size_t spilled( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( state_->mutex_ );
+
+		return state_->file_.size( );
+	}
+
+	Q_NODISCARD
+	bool is_closed( ) const
+	{
+		return state_->writable_.is_closed( );
+	}
+
+	/**
+	 * Closes the channel once all spilled values have been written to it.
+	 */
+	void close( )
+	{
+		state_->close( );
+	}
+
+private:
+	struct state
+	{
+		state(
+			writable< T... >&& writable,
+			const std::string& path,
+			serializer_type&& serializer,
+			deserializer_type&& deserializer
+		)
+		: mutex_( Q_HERE, "spilling_writable" )
+		, writable_( std::move( writable ) )
+		, file_( path )
+		, serializer_( std::move( serializer ) )
+		, deserializer_( std::move( deserializer ) )
+		, closing_( false )
+		{ }
+
+		~state( )
+		{
+			writable_.unset_resume_notification( );
+		}
+
+		bool write( tuple_type&& t )
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closing_ || writable_.is_closed( ) )
+				return false;
+
+			if ( file_.empty( ) && writable_.should_write( ) )
+				return writable_.write( std::move( t ) );
+
+			file_.append(
+				call_with_const_args_by_tuple( serializer_, t ) );
+
+			return true;
+		}
+
+		/**
+		 * Writes spilled values to the channel. If a record can't be
+		 * read or deserialized, it's lost, so the channel is closed with
+		 * that exception rather than continuing out of order (or not at
+		 * all, leaving the readers waiting forever).
+		 */
+		void drain( )
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			try
+			{
+				std::string record;
+
+				while (
+					writable_.should_write( ) &&
+					file_.read( record )
+				)
+					ignore_result( writable_.write(
+						deserializer_( record ) ) );
+
+				if ( closing_ && file_.empty( ) )
+					close_writable( );
+			}
+			catch ( ... )
+			{
+				closing_ = true;
+				writable_.unset_resume_notification( );
+				writable_.close( std::current_exception( ) );
+			}
+		}
+
+		void close( )
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			closing_ = true;
+
+			if ( file_.empty( ) )
+				close_writable( );
+		}
+
+		void close_writable( )
+		{
+			writable_.unset_resume_notification( );
+			writable_.close( );
+		}
+
+		mutex mutex_;
+		writable< T... > writable_;
+		spill_file file_;
+		serializer_type serializer_;
+		deserializer_type deserializer_;
+		bool closing_;
+	};
+
+	std::shared_ptr< state > state_;
+};
+
+} // namespace q
+
+#endif // LIBQ_SPILL_HPP
@@ -38,6 +38,23 @@ public:
 
 	std::size_t parallelism( ) const override;
 
+	/**
+	 * With worker affinity, a task pushed by a worker thread to a queue
+	 * consumed by this threadpool (e.g. the continuation of a promise
+	 * resolved by the worker) is run next by the same worker, while its
+	 * data is still in the cache, rather than by whichever thread picks it
+	 * up from the queue. This relaxes the FIFO and priority order of the
+	 * queues.
+	 *
+	 * A worker holds only one such task at a time (others are pushed to
+	 * the queue as usual), and runs at most 16 in a row before returning
+	 * to the queues. If the worker is still busy with its current task a
+	 * few milliseconds later, an idle worker pushes the held task back to
+	 * its queue, so that it's run by any worker. Held tasks are counted
+	 * by the queue's accounting. Disabled by default.
+	 */
+	void set_worker_affinity( bool enabled );
+
 	static std::shared_ptr< threadpool >
 	construct( const std::string& name,
 	           const queue_ptr& queue,
@@ -18,6 +18,7 @@
 #define LIBQ_TIME_SET_HPP
 
 #include <q/timer.hpp>
+#include <q/memory.hpp>
 
 #include <map>
 
@@ -136,7 +137,12 @@ public:
 	}
 
 private:
-	std::multimap< timer::point_type, T > map_;
+	std::multimap<
+		timer::point_type,
+		T,
+		std::less< timer::point_type >,
+		allocator< std::pair< const timer::point_type, T > >
+	> map_;
 };
 
 } // namespace q
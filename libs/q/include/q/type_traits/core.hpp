@@ -18,6 +18,7 @@
 #define LIBQ_TYPE_TRAITS_CORE_HPP
 
 #include <ciso646>
+#include <cstdint>
 #include <type_traits>
 #include <tuple>
 #include <memory>
@@ -111,6 +112,18 @@ struct objectify< void >
 template< typename T >
 using objectify_t = typename objectify< T >::type;
 
+/**
+ * Whether T is a const lvalue reference, such as `const int&`.
+ */
+template< typename T >
+struct is_const_lvalue_reference
+: bool_type_t<
+	std::is_lvalue_reference< T >::value
+	and
+	std::is_const< typename std::remove_reference< T >::type >::value
+>
+{ };
+
 namespace detail {
 
 template< typename T >
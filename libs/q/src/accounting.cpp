@@ -0,0 +1,131 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <q/accounting.hpp>
+
+#include "detail/thread_counters.hpp"
+
+#include <atomic>
+
+namespace q {
+
+namespace {
+
+std::atomic< bool > enabled_( false );
+
+struct object_accounting_tag { };
+
+// A count and a byte counter per accounted_object
+typedef detail::thread_counters< object_accounting_tag, 6 > object_counters;
+
+object_count get_count(
+	const object_counters::values_type& values,
+	detail::accounted_object kind )
+{
+	auto index = static_cast< std::size_t >( kind ) * 2;
+
+	// Objects can be destructed by other threads than the ones which
+	// created them, so the sum can be negative if summed in between.
+	auto positive = [ ]( std::int64_t value )
+	{
+		return static_cast< std::size_t >( value < 0 ? 0 : value );
+	};
+
+	return object_count{
+		positive( values[ index ] ),
+		positive( values[ index + 1 ] )
+	};
+}
+
+void print_count(
+	std::ostream& os, const char* name, const object_count& count )
+{
+	os << "\t" << name << ": " << count.count
+		<< " (" << count.bytes << " bytes)" << std::endl;
+}
+
+} // anonymous namespace
+
+void set_object_accounting( bool enabled )
+{
+	enabled_.store( enabled, std::memory_order_relaxed );
+}
+
+bool is_object_accounting_enabled( ) noexcept
+{
+	return enabled_.load( std::memory_order_relaxed );
+}
+
+object_accounting get_object_accounting( )
+{
+	auto values = object_counters::sum( );
+
+	object_accounting accounting;
+
+	accounting.enabled = is_object_accounting_enabled( );
+
+	accounting.defers = get_count(
+		values, detail::accounted_object::defer );
+	accounting.continuations = get_count(
+		values, detail::accounted_object::continuation );
+	accounting.channel_elements = get_count(
+		values, detail::accounted_object::channel_element );
+
+	accounting.queues = detail::get_queue_accounting( );
+
+	accounting.queued_tasks = object_count{ 0, 0 };
+	for ( auto& queue : accounting.queues )
+	{
+		accounting.queued_tasks.count += queue.tasks.count;
+		accounting.queued_tasks.bytes += queue.tasks.bytes;
+	}
+
+	return accounting;
+}
+
+std::ostream& operator<<( std::ostream& os, const object_accounting& value )
+{
+	os << "Object accounting ("
+		<< ( value.enabled ? "enabled" : "disabled" ) << "):" << std::endl;
+
+	print_count( os, "defers", value.defers );
+	print_count( os, "continuations", value.continuations );
+	print_count( os, "channel elements", value.channel_elements );
+	print_count( os, "queued tasks", value.queued_tasks );
+
+	for ( auto& queue : value.queues )
+		os << "\t\tqueue (priority " << queue.priority << "): "
+			<< queue.tasks.count << " ("
+			<< queue.tasks.bytes << " bytes)" << std::endl;
+
+	return os;
+}
+
+namespace detail {
+
+void account_objects(
+	accounted_object kind, std::int64_t count, std::int64_t bytes )
+noexcept
+{
+	auto index = static_cast< std::size_t >( kind ) * 2;
+
+	object_counters::add( index, count );
+	object_counters::add( index + 1, bytes );
+}
+
+} // namespace detail
+
+} // namespace q
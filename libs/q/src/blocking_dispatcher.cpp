@@ -3,6 +3,8 @@
 #include <q/mutex.hpp>
 #include <q/time_set.hpp>
 
+#include "detail/worker.hpp"
+
 #include <queue>
 
 namespace q {
@@ -69,6 +71,11 @@ void blocking_dispatcher::start( )
 	pimpl_->running_ = true;
 	pimpl_->started_ = true;
 
+	// Only for current_event_dispatcher( ), tasks are run in order
+	detail::worker_context worker( this );
+	auto prev_worker = detail::get_current_worker( );
+	detail::set_current_worker( &worker );
+
 	do
 	{
 		if ( pimpl_->stop_asap_ )
@@ -84,7 +91,12 @@ void blocking_dispatcher::start( )
 			{
 				Q_AUTO_UNIQUE_UNLOCK( lock );
 
-				task( );
+				// The task is destructed before re-locking, as
+				// destructing it can settle promises (abandoned
+				// defers) and thereby push tasks, which notifies
+				// this dispatcher.
+				auto fn = std::move( task );
+				fn( );
 
 				continue;
 			}
@@ -111,7 +123,8 @@ void blocking_dispatcher::start( )
 		{
 			Q_AUTO_UNIQUE_UNLOCK( lock );
 
-			_task.task_( );
+			auto fn = std::move( _task.task_ );
+			fn( );
 
 			continue;
 		}
@@ -129,6 +142,8 @@ void blocking_dispatcher::start( )
 		}
 	}
 	while ( true );
+
+	detail::set_current_worker( prev_worker );
 }
 
 void blocking_dispatcher::do_terminate( termination method )
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <q/cancellation.hpp>
+#include <q/mutex.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace q {
+
+namespace {
+
+// Expired registrations are pruned when this many have been added since the
+// last pruning (or at least as many as were kept by it).
+static constexpr std::size_t min_prune_size = 16;
+
+} // anonymous namespace
+
+struct cancellation::pimpl
+{
+	pimpl( )
+	: mutex_( Q_HERE, "cancellation" )
+	, cancelled_( false )
+	, prune_at_( min_prune_size )
+	{ }
+
+	struct callback
+	{
+		task fn_;
+		bool owned_;
+		std::weak_ptr< void > owner_;
+
+		bool expired( ) const
+		{
+			return owned_ && owner_.expired( );
+		}
+	};
+
+	/**
+	 * Adds the callback, unless cancelled, in which case it's returned
+	 * to be called directly.
+	 */
+	bool add( callback&& cb )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( cancelled_.load( std::memory_order_relaxed ) )
+			return false;
+
+		if ( callbacks_.size( ) >= prune_at_ )
+		{
+			callbacks_.erase(
+				std::remove_if(
+					callbacks_.begin( ),
+					callbacks_.end( ),
+					[ ]( const callback& cb )
+					{
+						return cb.expired( );
+					} ),
+				callbacks_.end( ) );
+
+			prune_at_ = std::max(
+				min_prune_size, callbacks_.size( ) * 2 );
+		}
+
+		callbacks_.push_back( std::move( cb ) );
+		return true;
+	}
+
+	mutex mutex_;
+	std::atomic< bool > cancelled_;
+	std::vector< callback > callbacks_;
+	std::size_t prune_at_;
+};
+
+cancellation::cancellation( )
+: pimpl_( std::make_shared< pimpl >( ) )
+{ }
+
+void cancellation::cancel( )
+{
+	std::vector< pimpl::callback > callbacks;
+
+	{
+		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_ );
+
+		if ( pimpl_->cancelled_.exchange( true ) )
+			return;
+
+		callbacks.swap( pimpl_->callbacks_ );
+	}
+
+	for ( auto& callback : callbacks )
+		if ( !callback.expired( ) )
+			callback.fn_( );
+}
+
+bool cancellation::is_cancelled( ) const
+{
+	return pimpl_->cancelled_.load( std::memory_order_acquire );
+}
+
+void cancellation::throw_if_cancelled( ) const
+{
+	if ( is_cancelled( ) )
+		Q_THROW( cancellation_exception( ) );
+}
+
+void cancellation::on_cancel( task fn ) const
+{
+	pimpl::callback cb{ std::move( fn ), false, std::weak_ptr< void >( ) };
+
+	if ( !pimpl_->add( std::move( cb ) ) )
+		cb.fn_( );
+}
+
+void cancellation::on_cancel( task fn, std::weak_ptr< void > owner ) const
+{
+	pimpl::callback cb{ std::move( fn ), true, std::move( owner ) };
+
+	if ( !pimpl_->add( std::move( cb ) ) )
+		cb.fn_( );
+}
+
+} // namespace q
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_INTERNAL_TASK_STORAGE_HPP
+#define LIBQ_INTERNAL_TASK_STORAGE_HPP
+
+#include <q/types.hpp>
+#include <q/memory.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace q { namespace detail {
+
+/**
+ * A FIFO of tasks, stored compactly back-to-back in chunks of memory.
+ *
+ * A task object is large enough to inline most function objects, so a
+ * container of tasks wastes most of its memory on tasks capturing little.
+ * Instead, the function of each task is moved out of the task and into a
+ * record taking only the space the function needs. A popped task refers to
+ * its record, and the function is called and destructed in place, without
+ * being moved back. A chunk is therefore kept alive (and not reused) until
+ * the tasks popped from it have finished.
+ */
+class task_storage
+{
+public:
+	task_storage( )
+	: head_( nullptr )
+	, tail_( nullptr )
+	, spare_( nullptr )
+	, size_( 0 )
+	, chunks_( 0 )
+	{ }
+
+	task_storage( const task_storage& ) = delete;
+	task_storage& operator=( const task_storage& ) = delete;
+
+	~task_storage( )
+	{
+		while ( !empty( ) )
+			pop( );
+
+		release_chunk( head_ );
+		release_chunk( spare_ );
+	}
+
+	bool empty( ) const
+	{
+		return size_ == 0;
+	}
+
+	std::size_t size( ) const
+	{
+		return size_;
+	}
+
+	/**
+	 * The memory allocated by the storage, in bytes. Chunks only kept alive
+	 * by popped tasks which haven't finished yet aren't included.
+	 */
+	std::size_t allocated_bytes( ) const
+	{
+		return chunks_ * sizeof( chunk );
+	}
+
+	void push( task&& t )
+	{
+		auto alignment = t.compacted_alignment( );
+		if ( alignment < record_align )
+			alignment = record_align;
+		auto size = t.compacted_size( );
+
+		std::size_t payload_offset;
+		std::size_t record_size;
+
+		if (
+			!tail_ ||
+			!fits( tail_, size, alignment, payload_offset, record_size )
+		)
+		{
+			add_chunk( );
+			fits( tail_, size, alignment, payload_offset, record_size );
+		}
+
+		auto data = tail_->data_ + tail_->end_;
+		auto rec = ::new ( data ) record;
+
+		rec->size_ = record_size;
+		rec->payload_offset_ = payload_offset;
+		rec->task_ = t.compact_to( data + payload_offset );
+
+		tail_->end_ += record_size;
+		++size_;
+	}
+
+	task pop( )
+	{
+		auto c = head_;
+		auto rec = reinterpret_cast< record* >( c->data_ + c->begin_ );
+
+		c->refs_.fetch_add( 1, std::memory_order_relaxed );
+		c->begin_ += rec->size_;
+		--size_;
+
+		if ( c->begin_ == c->end_ )
+			consumed_chunk( );
+
+		return popped_task( c, rec );
+	}
+
+private:
+	static constexpr std::size_t record_align = 16;
+	static constexpr std::size_t chunk_size = 4096;
+
+	struct record
+	{
+		std::size_t size_;
+		std::size_t payload_offset_;
+		task::compacted task_;
+	};
+
+	struct chunk
+	{
+		chunk* next_;
+		std::size_t begin_;
+		std::size_t end_;
+		// One for the storage, and one per popped task not yet finished
+		std::atomic< std::size_t > refs_;
+		// The allocator of the storage, as popped tasks may free the chunk
+		allocator< chunk > allocator_;
+		alignas( LIBQ_ASSUMED_CACHE_LINE_SIZE )
+		unsigned char data_[ chunk_size ];
+	};
+
+	/**
+	 * A task popped from the storage, calling (and destructing) the
+	 * function in its record, and then releasing the chunk.
+	 */
+	class popped_task
+	{
+	public:
+		popped_task( chunk* c, record* rec )
+		: chunk_( c )
+		, record_( rec )
+		{ }
+
+		popped_task( popped_task&& other ) noexcept
+		: chunk_( other.chunk_ )
+		, record_( other.record_ )
+		{
+			other.chunk_ = nullptr;
+		}
+
+		popped_task& operator=( popped_task&& ) = delete;
+
+		~popped_task( )
+		{
+			if ( chunk_ )
+				finish( );
+		}
+
+		void operator( )( ) noexcept
+		{
+			task::call_compacted( record_->task_ );
+			finish( );
+		}
+
+	private:
+		void finish( ) noexcept
+		{
+			auto payload = reinterpret_cast< unsigned char* >( record_ ) +
+				record_->payload_offset_;
+
+			task::destroy_compacted( record_->task_, payload );
+			record_->~record( );
+
+			release_chunk_ref( chunk_ );
+			chunk_ = nullptr;
+		}
+
+		chunk* chunk_;
+		record* record_;
+	};
+
+	static std::size_t align_up( std::size_t n, std::size_t alignment )
+	{
+		return ( n + alignment - 1 ) & ~( alignment - 1 );
+	}
+
+	/**
+	 * Gets where the payload of a new record at the end of chunk c would
+	 * be (relative to the record), and the size of the record, and returns
+	 * whether it fits in the chunk. The payload is aligned by its address,
+	 * as records are only aligned to record_align.
+	 */
+	static bool fits(
+		const chunk* c,
+		std::size_t size,
+		std::size_t alignment,
+		std::size_t& payload_offset,
+		std::size_t& record_size
+	)
+	{
+		auto begin = reinterpret_cast< std::uintptr_t >( c->data_ );
+		auto rec = begin + c->end_;
+		auto payload = align_up( rec + sizeof( record ), alignment );
+
+		payload_offset = payload - rec;
+		record_size = align_up( payload_offset + size, record_align );
+
+		return c->end_ + record_size <= chunk_size;
+	}
+
+	void add_chunk( )
+	{
+		chunk* c = spare_;
+		spare_ = nullptr;
+
+		if ( !c )
+		{
+			c = allocator_.allocate( 1 );
+			::new ( &c->refs_ ) std::atomic< std::size_t >( 1 );
+			::new ( &c->allocator_ ) allocator< chunk >( allocator_ );
+			++chunks_;
+		}
+
+		c->next_ = nullptr;
+		c->begin_ = 0;
+		c->end_ = 0;
+
+		if ( tail_ )
+			tail_->next_ = c;
+		else
+			head_ = c;
+
+		tail_ = c;
+	}
+
+	/**
+	 * Whether the chunk is only referred to by the storage, i.e. all tasks
+	 * popped from it have finished, so it can be reused.
+	 */
+	static bool unused( const chunk* c )
+	{
+		return c->refs_.load( std::memory_order_acquire ) == 1;
+	}
+
+	void consumed_chunk( )
+	{
+		auto c = head_;
+
+		if ( head_ == tail_ )
+		{
+			if ( unused( c ) )
+			{
+				// Reuse the only chunk from the start
+				c->begin_ = 0;
+				c->end_ = 0;
+				return;
+			}
+
+			head_ = tail_ = nullptr;
+		}
+		else
+			head_ = head_->next_;
+
+		if ( unused( c ) )
+		{
+			// Keep one chunk around, to not allocate a new one every
+			// time the queue grows past a chunk boundary
+			release_chunk( spare_ );
+			spare_ = c;
+			return;
+		}
+
+		// Freed by the last of its popped tasks
+		--chunks_;
+		release_chunk_ref( c );
+	}
+
+	void release_chunk( chunk* c )
+	{
+		if ( c && release_chunk_ref( c ) )
+			--chunks_;
+	}
+
+	/**
+	 * Releases a reference to the chunk, and frees it (returning true) if
+	 * it was the last one.
+	 */
+	static bool release_chunk_ref( chunk* c ) noexcept
+	{
+		if ( c->refs_.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+			return false;
+
+		auto chunk_allocator = c->allocator_;
+
+		c->allocator_.~allocator( );
+		c->refs_.~atomic( );
+		chunk_allocator.deallocate( c, 1 );
+		return true;
+	}
+
+	allocator< chunk > allocator_;
+	chunk* head_;
+	chunk* tail_;
+	chunk* spare_;
+	std::size_t size_;
+	std::size_t chunks_;
+};
+
+} } // namespace detail, namespace q
+
+#endif // LIBQ_INTERNAL_TASK_STORAGE_HPP
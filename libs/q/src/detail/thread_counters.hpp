@@ -0,0 +1,222 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_INTERNAL_THREAD_COUNTERS_HPP
+#define LIBQ_INTERNAL_THREAD_COUNTERS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <set>
+#include <type_traits>
+
+namespace q { namespace detail {
+
+/**
+ * A set of Size signed counters, sharded per thread. A thread only writes to
+ * its own shard, so adding to a counter is a plain (relaxed) load and store,
+ * without atomic read-modify-write operations or shared cache lines. The
+ * counters are summed over all threads on demand.
+ *
+ * The shard of an exiting thread is merged into a common shard, so no counts
+ * are lost. Tag separates different sets of counters with the same Size.
+ */
+template< typename Tag, std::size_t Size >
+class thread_counters
+{
+public:
+	typedef std::array< std::int64_t, Size > values_type;
+
+	static void add( std::size_t index, std::int64_t value ) noexcept
+	{
+		if ( current_ )
+			current_->add( index, value );
+		else
+			add_slow( index, value );
+	}
+
+	static values_type sum( )
+	{
+		auto& reg = get_registry( );
+		std::unique_lock< std::mutex > lock( reg.mutex_ );
+
+		values_type values = reg.exited_;
+		for ( auto shard : reg.shards_ )
+			shard->add_to( values );
+
+		return values;
+	}
+
+private:
+	struct shard
+	{
+		shard( )
+		{
+			for ( auto& value : values_ )
+				value.store( 0, std::memory_order_relaxed );
+		}
+
+		void add( std::size_t index, std::int64_t value ) noexcept
+		{
+			auto& counter = values_[ index ];
+			counter.store(
+				counter.load( std::memory_order_relaxed ) + value,
+				std::memory_order_relaxed );
+		}
+
+		void add_to( values_type& values ) const
+		{
+			for ( std::size_t i = 0; i < Size; ++i )
+				values[ i ] += values_[ i ].load( std::memory_order_relaxed );
+		}
+
+		std::atomic< std::int64_t > values_[ Size ];
+	};
+
+	struct registry
+	{
+		registry( )
+		{
+			exited_.fill( 0 );
+		}
+
+		std::mutex mutex_;
+		std::set< shard* > shards_;
+		values_type exited_;
+	};
+
+	/**
+	 * Merges the thread's shard into the exited threads' counters when the
+	 * thread exits.
+	 */
+	struct shard_owner
+	{
+		~shard_owner( )
+		{
+			current_ = nullptr;
+			exited_ = true;
+
+			if ( !shard_ )
+				return;
+
+			auto& reg = get_registry( );
+
+			try
+			{
+				std::unique_lock< std::mutex > lock( reg.mutex_ );
+
+				reg.shards_.erase( shard_ );
+				shard_->add_to( reg.exited_ );
+			}
+			catch ( ... )
+			{
+				// The shard can't be unregistered, so it's leaked
+				// rather than freed while sum( ) may read it.
+				shard_ = nullptr;
+				return;
+			}
+
+			delete shard_;
+			shard_ = nullptr;
+		}
+
+		shard* shard_;
+	};
+
+	static registry& get_registry( ) noexcept
+	{
+		// Never destructed, as threads may exit after static destruction,
+		// and constructed in static storage, to not allocate
+		static typename std::aligned_storage<
+			sizeof( registry ), alignof( registry )
+		>::type storage;
+		static auto reg = ::new ( &storage ) registry;
+		return *reg;
+	}
+
+	/**
+	 * Adds to a new shard for this thread. This is called from hot paths
+	 * which can't throw, so if the shard can't be allocated (or the thread
+	 * is exiting), the value is added directly to the exited threads'
+	 * counters instead. If the registry can't even be locked, the value
+	 * is dropped.
+	 */
+	static void add_slow( std::size_t index, std::int64_t value ) noexcept
+	{
+		auto& reg = get_registry( );
+
+		try
+		{
+			std::unique_lock< std::mutex > lock( reg.mutex_ );
+
+			if ( exited_ )
+			{
+				reg.exited_[ index ] += value;
+				return;
+			}
+
+			auto new_shard = new ( std::nothrow ) shard;
+
+			if ( !new_shard )
+			{
+				reg.exited_[ index ] += value;
+				return;
+			}
+
+			try
+			{
+				reg.shards_.insert( new_shard );
+			}
+			catch ( ... )
+			{
+				delete new_shard;
+				reg.exited_[ index ] += value;
+				return;
+			}
+
+			current_ = new_shard;
+			owner_.shard_ = current_;
+
+			current_->add( index, value );
+		}
+		catch ( ... )
+		{ }
+	}
+
+	// These are trivially destructible, so they can be used safely by other
+	// thread-local objects' destructors.
+	static thread_local shard* current_;
+	static thread_local bool exited_;
+
+	static thread_local shard_owner owner_;
+};
+
+template< typename Tag, std::size_t Size >
+thread_local typename thread_counters< Tag, Size >::shard*
+	thread_counters< Tag, Size >::current_ = nullptr;
+
+template< typename Tag, std::size_t Size >
+thread_local bool thread_counters< Tag, Size >::exited_ = false;
+
+template< typename Tag, std::size_t Size >
+thread_local typename thread_counters< Tag, Size >::shard_owner
+	thread_counters< Tag, Size >::owner_;
+
+} } // namespace detail, namespace q
+
+#endif // LIBQ_INTERNAL_THREAD_COUNTERS_HPP
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_INTERNAL_WORKER_HPP
+#define LIBQ_INTERNAL_WORKER_HPP
+
+#include <q/event_dispatcher.hpp>
+#include <q/queue.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace q { namespace detail {
+
+/**
+ * The context of a thread which runs tasks for an event dispatcher.
+ *
+ * With worker affinity, a task pushed (by the worker itself) to a queue
+ * consumed by the worker's dispatcher is parked in the next_ slot instead of
+ * in the queue, and is run by the worker as soon as its current task returns,
+ * while the data it works on is likely still in the cache. If the slot is
+ * taken, tasks are pushed to the queue as usual.
+ *
+ * A parked task is counted by its queue's accounting, and can be taken by
+ * other (idle) workers, which push it back to its queue if it has been parked
+ * for longer than steal_after, so that a long running task doesn't hold back
+ * its continuation. Other workers look for parked tasks through an atomic
+ * park number, without locking anything.
+ */
+struct worker_context
+{
+	worker_context(
+		basic_event_dispatcher* dispatcher,
+		const std::atomic< std::size_t >* idle_workers = nullptr )
+	: dispatcher_( dispatcher )
+	, idle_workers_( idle_workers )
+	, affinity_( false )
+	, next_runs_( 0 )
+	, next_parked_( nullptr )
+	, parks_( 0 )
+	, parked_park_( 0 )
+	{ }
+
+	/**
+	 * Runs fn and then the parked task (and the ones it parks), but at most
+	 * max_next_runs in a row, to not starve the queues. Once stop( ) returns
+	 * true, the parked task is pushed back to its queue instead. Tasks are
+	 * only parked while this is running, so none is left behind when it
+	 * returns.
+	 */
+	template< typename Stop, typename Invoker >
+	void run( task&& fn, bool affinity, Stop&& stop, Invoker&& invoker )
+	{
+		affinity_ = affinity;
+
+		invoker( std::move( fn ) );
+
+		if ( !affinity )
+			return;
+
+		while ( true )
+		{
+			if ( stop( ) )
+			{
+				affinity_ = false;
+				publish( );
+				break;
+			}
+
+			task next = unpark( );
+			if ( !next )
+				break;
+
+			++next_runs_;
+			invoker( std::move( next ) );
+		}
+
+		affinity_ = false;
+		next_runs_ = 0;
+	}
+
+	bool can_take_next( ) const
+	{
+		return affinity_ && next_runs_ < max_next_runs;
+	}
+
+	/**
+	 * Parks fn, pushed to queue, unless another task is parked already.
+	 * parked is the queue's counter of parked tasks.
+	 */
+	bool park( task& fn, queue& queue, std::atomic< std::size_t >& parked )
+	{
+		{
+			std::unique_lock< std::mutex > lock( next_mutex_ );
+
+			if ( next_ )
+				return false;
+
+			next_ = std::move( fn );
+			next_queue_ = queue.shared_from_this( );
+			next_parked_ = &parked;
+			parked.fetch_add( 1, std::memory_order_relaxed );
+			parked_park_.store( ++parks_, std::memory_order_release );
+		}
+
+		// Idle workers won't look for parked tasks until woken up
+		if ( idle_workers_ && idle_workers_->load( ) )
+			dispatcher_->notify( );
+
+		return true;
+	}
+
+	/**
+	 * Takes the parked task to be run, or returns an empty task.
+	 */
+	task unpark( )
+	{
+		task fn;
+		queue_ptr queue;
+
+		std::unique_lock< std::mutex > lock( next_mutex_ );
+		take( fn, queue );
+
+		return fn;
+	}
+
+	/**
+	 * Pushes the parked task (if any) back to its queue.
+	 */
+	void publish( )
+	{
+		task fn;
+		queue_ptr queue;
+
+		{
+			std::unique_lock< std::mutex > lock( next_mutex_ );
+			take( fn, queue );
+		}
+
+		if ( fn )
+			queue->push( std::move( fn ) );
+	}
+
+	/**
+	 * Returns the park number of the parked task, or 0 if there is none.
+	 * If it's unchanged after steal_after, the task has been parked all
+	 * the time, and should be stolen. This doesn't lock, so it's only a
+	 * hint; steal( ) checks the number again.
+	 */
+	std::size_t parked( ) const
+	{
+		return parked_park_.load( std::memory_order_acquire );
+	}
+
+	/**
+	 * Takes the parked task and its queue, if it has the park number park.
+	 * This is called by other workers, which then push it to the queue.
+	 */
+	bool steal( std::size_t park, task& fn, queue_ptr& queue )
+	{
+		std::unique_lock< std::mutex > lock( next_mutex_ );
+
+		if ( !next_ || parks_ != park )
+			return false;
+
+		take( fn, queue );
+		return true;
+	}
+
+	static constexpr std::size_t max_next_runs = 16;
+
+	static constexpr std::chrono::milliseconds steal_after =
+		std::chrono::milliseconds( 2 );
+
+	basic_event_dispatcher* dispatcher_;
+	const std::atomic< std::size_t >* idle_workers_;
+	bool affinity_;
+	std::size_t next_runs_;
+
+private:
+	// Must be called with next_mutex_ locked
+	void take( task& fn, queue_ptr& queue )
+	{
+		if ( !next_ )
+			return;
+
+		fn = std::move( next_ );
+		next_ = nullptr;
+		queue = std::move( next_queue_ );
+		next_parked_->fetch_sub( 1, std::memory_order_relaxed );
+		parked_park_.store( 0, std::memory_order_relaxed );
+	}
+
+	// The parked task, which other workers may steal
+	std::mutex next_mutex_;
+	task next_;
+	queue_ptr next_queue_;
+	std::atomic< std::size_t >* next_parked_;
+	std::size_t parks_;
+	// parks_ while a task is parked, otherwise 0, see parked( )
+	std::atomic< std::size_t > parked_park_;
+};
+
+worker_context* get_current_worker( ) noexcept;
+
+/**
+ * Sets (or with nullptr, unsets) the worker context of the current thread.
+ */
+void set_current_worker( worker_context* worker ) noexcept;
+
+} } // namespace detail, namespace q
+
+#endif // LIBQ_INTERNAL_WORKER_HPP
@@ -36,4 +36,10 @@ scheduler_ptr execution_context::scheduler( ) const
 	return pimpl_->scheduler_;
 }
 
+void execution_context::set_allocator_functions(
+	const allocator_functions& functions )
+{
+	pimpl_->event_dispatcher_->set_allocator_functions( functions );
+}
+
 } // namespace q
@@ -17,11 +17,103 @@
 #include <q/function.hpp>
 #include <q/exception.hpp>
 
-namespace q { namespace detail {
+#include "detail/thread_counters.hpp"
+
+#include <mutex>
+
+namespace q {
+
+constexpr std::size_t function_stats::size_granularity;
+constexpr std::size_t function_stats::num_sizes;
+
+namespace detail {
 
 [[noreturn]] void _throw_bad_function_call_exception( )
 {
 	Q_THROW( q::bad_function_call( ) );
 }
 
-} } // namespace detail, namespace q
+namespace {
+
+// The counters are the storage methods (indexed by function_storage), the
+// number of unique and shared functions, and the size histogram.
+static constexpr std::size_t unique_index = 5;
+static constexpr std::size_t shared_index = 6;
+static constexpr std::size_t sizes_index = 7;
+
+struct function_stats_tag { };
+
+typedef thread_counters<
+	function_stats_tag, sizes_index + function_stats::num_sizes
+> function_counters;
+
+std::mutex baseline_mutex_;
+function_counters::values_type baseline_{ };
+
+} // anonymous namespace
+
+void record_function_stats(
+	std::size_t size, bool shared, function_storage storage ) noexcept
+{
+	auto index = size == 0
+		? 0
+		: ( size - 1 ) / function_stats::size_granularity;
+	if ( index >= function_stats::num_sizes )
+		index = function_stats::num_sizes - 1;
+
+	function_counters::add( static_cast< std::size_t >( storage ), 1 );
+	function_counters::add( shared ? shared_index : unique_index, 1 );
+	function_counters::add( sizes_index + index, 1 );
+}
+
+} // namespace detail
+
+function_stats get_function_stats( )
+{
+	auto values = detail::function_counters::sum( );
+
+	{
+		std::unique_lock< std::mutex > lock( detail::baseline_mutex_ );
+
+		for ( std::size_t i = 0; i < values.size( ); ++i )
+			values[ i ] -= detail::baseline_[ i ];
+	}
+
+	auto get = [ &values ]( std::size_t index )
+	{
+		return static_cast< std::size_t >( values[ index ] );
+	};
+	auto get_storage = [ &get ]( detail::function_storage storage )
+	{
+		return get( static_cast< std::size_t >( storage ) );
+	};
+
+	function_stats stats;
+	stats.plain = get_storage( detail::function_storage::plain );
+	stats.inlined = get_storage( detail::function_storage::inlined );
+	stats.unique_ptr = get_storage( detail::function_storage::unique_ptr );
+	stats.shared_ptr = get_storage( detail::function_storage::shared_ptr );
+	stats.unique_functions = get( detail::unique_index );
+	stats.shared_functions = get( detail::shared_index );
+	for ( std::size_t i = 0; i < function_stats::num_sizes; ++i )
+		stats.sizes[ i ] = get( detail::sizes_index + i );
+
+	return stats;
+}
+
+void set_function_stats_enabled( bool enabled ) noexcept
+{
+	detail::function_stats_flag( ).store(
+		enabled, std::memory_order_relaxed );
+}
+
+void reset_function_stats( )
+{
+	auto values = detail::function_counters::sum( );
+
+	std::unique_lock< std::mutex > lock( detail::baseline_mutex_ );
+
+	detail::baseline_ = values;
+}
+
+} // namespace q
@@ -0,0 +1,733 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <q/memory.hpp>
+#include <q/event_dispatcher.hpp>
+#include <q/exception.hpp>
+
+#include "detail/worker.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace q {
+
+namespace {
+
+void* default_allocate( std::size_t size )
+{
+	return ::operator new( size );
+}
+
+void default_deallocate( void* ptr, std::size_t )
+{
+	::operator delete( ptr );
+}
+
+const allocator_functions default_functions_{
+	&default_allocate,
+	&default_deallocate
+};
+
+std::atomic< const allocator_functions* > functions_( &default_functions_ );
+
+/**
+ * Memory allocated without an allocator object, i.e. by detail::allocate( )
+ * without functions, is prefixed with a header pointing to the functions
+ * which allocated it, so that it's deallocated by them too. The header is
+ * padded to keep the memory after it maximally aligned.
+ */
+union allocation_header
+{
+	const allocator_functions* functions_;
+	std::max_align_t align_;
+};
+
+/**
+ * Returns a copy of the functions which lives forever, as allocations refer
+ * to it. Setting the same functions again reuses the copy.
+ */
+const allocator_functions* intern( const allocator_functions& functions )
+{
+	if ( !functions.allocate || !functions.deallocate )
+		Q_THROW( invalid_argument( "null allocator function" ) );
+
+	if (
+		functions.allocate == default_functions_.allocate &&
+		functions.deallocate == default_functions_.deallocate
+	)
+		return &default_functions_;
+
+	static std::mutex mutex;
+	static auto interned = new std::vector< const allocator_functions* >;
+
+	std::unique_lock< std::mutex > lock( mutex );
+
+	for ( auto existing : *interned )
+		if (
+			existing->allocate == functions.allocate &&
+			existing->deallocate == functions.deallocate
+		)
+			return existing;
+
+	interned->push_back( new allocator_functions( functions ) );
+
+	return interned->back( );
+}
+
+const allocator_functions* current_functions( ) noexcept
+{
+	auto worker = detail::get_current_worker( );
+
+	if ( worker )
+	{
+		auto functions = worker->dispatcher_->get_allocator_functions( );
+
+		if ( functions )
+			return functions;
+	}
+
+	return functions_.load( std::memory_order_acquire );
+}
+
+} // anonymous namespace
+
+void set_allocator_functions( const allocator_functions& functions )
+{
+	functions_.store( intern( functions ), std::memory_order_release );
+}
+
+allocator_functions get_allocator_functions( )
+{
+	return *functions_.load( std::memory_order_acquire );
+}
+
+void basic_event_dispatcher::set_allocator_functions(
+	const allocator_functions& functions )
+{
+	allocator_functions_.store(
+		intern( functions ), std::memory_order_release );
+}
+
+namespace detail {
+
+const allocator_functions* current_allocator_functions( ) noexcept
+{
+	return current_functions( );
+}
+
+void* allocate( const allocator_functions* functions, std::size_t size )
+{
+	auto ptr = functions->allocate( size );
+
+	if ( !ptr )
+		throw std::bad_alloc( );
+
+	return ptr;
+}
+
+void deallocate(
+	const allocator_functions* functions, void* ptr, std::size_t size )
+noexcept
+{
+	functions->deallocate( ptr, size );
+}
+
+namespace {
+
+// The memory is over-allocated so that it can be aligned, and the pointer to
+// the allocated memory is stored right before the aligned pointer.
+std::size_t over_aligned_size( std::size_t size, std::size_t alignment )
+{
+	return size + alignment + sizeof( void* );
+}
+
+void* align_within( void* raw, std::size_t alignment )
+{
+	auto address = reinterpret_cast< std::uintptr_t >(
+		static_cast< char* >( raw ) + sizeof( void* ) );
+	address = ( address + alignment - 1 ) & ~( alignment - 1 );
+
+	auto aligned = reinterpret_cast< void** >( address );
+	aligned[ -1 ] = raw;
+
+	return aligned;
+}
+
+void* unaligned_of( void* ptr )
+{
+	return static_cast< void** >( ptr )[ -1 ];
+}
+
+} // anonymous namespace
+
+void* allocate_aligned(
+	const allocator_functions* functions,
+	std::size_t size,
+	std::size_t alignment
+)
+{
+	return align_within(
+		allocate( functions, over_aligned_size( size, alignment ) ),
+		alignment );
+}
+
+void deallocate_aligned(
+	const allocator_functions* functions,
+	void* ptr,
+	std::size_t size,
+	std::size_t alignment
+) noexcept
+{
+	deallocate(
+		functions,
+		unaligned_of( ptr ),
+		over_aligned_size( size, alignment ) );
+}
+
+void* allocate( std::size_t size )
+{
+	auto functions = current_functions( );
+
+	auto header = static_cast< allocation_header* >(
+		allocate( functions, size + sizeof( allocation_header ) ) );
+
+	header->functions_ = functions;
+
+	return header + 1;
+}
+
+void deallocate( void* ptr, std::size_t size ) noexcept
+{
+	auto header = static_cast< allocation_header* >( ptr ) - 1;
+
+	deallocate(
+		header->functions_, header, size + sizeof( allocation_header ) );
+}
+
+void* allocate_aligned( std::size_t size, std::size_t alignment )
+{
+	return align_within(
+		allocate( over_aligned_size( size, alignment ) ), alignment );
+}
+
+void deallocate_aligned(
+	void* ptr, std::size_t size, std::size_t alignment ) noexcept
+{
+	deallocate( unaligned_of( ptr ), over_aligned_size( size, alignment ) );
+}
+
+namespace {
+
+static constexpr std::size_t size_class_granularity = 32;
+static constexpr std::size_t num_size_classes = 16;
+static constexpr std::size_t max_pooled_size =
+	size_class_granularity * num_size_classes;
+
+// The size of the chunks which blocks are carved from
+static constexpr std::size_t chunk_size = 8192;
+
+// The number of empty chunks a pool keeps per size class, rather than
+// returning them to the system
+static constexpr std::size_t max_empty_chunks = 1;
+
+// The number of allocations and frees by its thread between which a pool
+// takes back the blocks freed by other threads
+static constexpr std::size_t remote_drain_interval = 64;
+
+class thread_pool;
+struct heap;
+struct chunk;
+
+/**
+ * Every block is prefixed with a header pointing to the chunk it was carved
+ * from, or nullptr if it was allocated without a pool. The header is padded
+ * to keep the memory after it maximally aligned.
+ */
+union block_header
+{
+	chunk* chunk_;
+	std::max_align_t align_;
+};
+
+struct free_block
+{
+	free_block* next_;
+};
+
+// Marks the remote free list of a pool whose thread has exited
+free_block orphaned_;
+
+/**
+ * The chunks of a pool which were allocated by one set of allocator
+ * functions. Blocks are only handed out from chunks of the current
+ * functions, so that they're charged for all pooled memory they use.
+ */
+struct heap
+{
+	const allocator_functions* functions_;
+	heap* next_;
+	chunk* partial_[ num_size_classes ];
+	chunk* empty_[ num_size_classes ];
+	std::size_t empty_count_[ num_size_classes ];
+};
+
+/**
+ * A chunk of memory which the blocks of one size class are carved from, as
+ * they are needed. Freed blocks are kept in the free list of their chunk.
+ * The blocks follow the chunk, and keep its alignment.
+ */
+struct alignas( std::max_align_t ) chunk
+{
+	thread_pool* pool_;
+	heap* heap_;
+	chunk* prev_;
+	chunk* next_;
+	free_block* free_;
+	std::size_t size_class_;
+	std::size_t used_;
+	std::size_t carved_;
+	std::size_t capacity_;
+};
+
+std::size_t size_class_of( std::size_t size )
+{
+	return size == 0 ? 0 : ( size - 1 ) / size_class_granularity;
+}
+
+std::size_t block_stride( std::size_t size_class )
+{
+	return sizeof( block_header ) +
+		( size_class + 1 ) * size_class_granularity;
+}
+
+/**
+ * A pool is owned by one thread, which is the only one allocating from it
+ * and freeing blocks into its chunks. Other threads return blocks to the
+ * remote free list, which the owner takes over every remote_drain_interval
+ * allocations and frees, and when it runs out of blocks of a size class.
+ *
+ * Chunks with free blocks are linked per heap and size class, full chunks
+ * aren't linked at all. When all blocks of a chunk are freed, the chunk is
+ * kept for reuse if its heap has less than max_empty_chunks of that size
+ * class, and is otherwise returned to the allocator functions.
+ *
+ * The pool is reference counted by its thread and by every chunk with blocks
+ * in use (including blocks in the remote free list), so it outlives its
+ * thread if blocks are still in use elsewhere. When the thread exits, the
+ * pool is orphaned, and blocks are from then on freed into their chunks
+ * under a mutex. Whoever releases the last reference frees all the memory.
+ */
+class thread_pool
+{
+public:
+	thread_pool( )
+	: refs_( 1 )
+	, remote_( nullptr )
+	, heaps_( nullptr )
+	, until_drain_( remote_drain_interval )
+	{ }
+
+	~thread_pool( )
+	{
+		// No blocks are in use, so all chunks are empty
+		while ( heaps_ )
+		{
+			auto h = heaps_;
+			heaps_ = h->next_;
+
+			for ( std::size_t i = 0; i < num_size_classes; ++i )
+			{
+				free_chunks( h->partial_[ i ] );
+				free_chunks( h->empty_[ i ] );
+			}
+
+			delete h;
+		}
+	}
+
+	void* allocate(
+		const allocator_functions* functions, std::size_t size_class )
+	{
+		auto& h = heap_of( functions );
+
+		chunk* c = h.partial_[ size_class ];
+
+		if ( !c )
+		{
+			take_remote( );
+			c = h.partial_[ size_class ];
+		}
+
+		if ( !c )
+			c = reuse_chunk( h, size_class );
+
+		if ( c->used_ == 0 )
+			refs_.fetch_add( 1, std::memory_order_relaxed );
+
+		block_header* header;
+
+		if ( c->free_ )
+		{
+			auto block = c->free_;
+			c->free_ = block->next_;
+			header = reinterpret_cast< block_header* >( block ) - 1;
+		}
+		else
+		{
+			header = reinterpret_cast< block_header* >(
+				reinterpret_cast< unsigned char* >( c + 1 ) +
+				c->carved_++ * block_stride( size_class ) );
+			header->chunk_ = c;
+		}
+
+		if ( ++c->used_ == c->capacity_ )
+			unlink( c );
+
+		drain_periodically( );
+
+		return header + 1;
+	}
+
+	void deallocate_local( void* ptr ) noexcept
+	{
+		if ( free_local( ptr ) )
+			release( );
+
+		drain_periodically( );
+	}
+
+	void deallocate_remote( void* ptr ) noexcept
+	{
+		auto block = static_cast< free_block* >( ptr );
+
+		block->next_ = remote_.load( std::memory_order_relaxed );
+		do
+		{
+			if ( block->next_ == &orphaned_ )
+			{
+				deallocate_orphaned( ptr );
+				return;
+			}
+		}
+		while ( !remote_.compare_exchange_weak(
+			block->next_, block,
+			std::memory_order_release, std::memory_order_relaxed ) );
+	}
+
+	/**
+	 * Called by the owning thread when it exits. Takes back the remotely
+	 * freed blocks, and makes further frees go to deallocate_orphaned( ).
+	 */
+	void orphan( ) noexcept
+	{
+		std::unique_lock< std::mutex > lock( mutex_ );
+
+		free_remote( remote_.exchange(
+			&orphaned_, std::memory_order_acquire ) );
+
+		lock.unlock( );
+
+		release( );
+	}
+
+	void release( ) noexcept
+	{
+		if ( refs_.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+			delete this;
+	}
+
+private:
+	static chunk* chunk_of( void* ptr ) noexcept
+	{
+		return ( static_cast< block_header* >( ptr ) - 1 )->chunk_;
+	}
+
+	/**
+	 * Gets the heap of the functions, the most recently used one first.
+	 */
+	heap& heap_of( const allocator_functions* functions )
+	{
+		if ( heaps_ && heaps_->functions_ == functions )
+			return *heaps_;
+
+		heap** link = &heaps_;
+
+		while ( *link && ( *link )->functions_ != functions )
+			link = &( *link )->next_;
+
+		auto h = *link;
+
+		if ( h )
+			*link = h->next_;
+		else
+		{
+			h = new heap;
+			h->functions_ = functions;
+
+			for ( std::size_t i = 0; i < num_size_classes; ++i )
+			{
+				h->partial_[ i ] = nullptr;
+				h->empty_[ i ] = nullptr;
+				h->empty_count_[ i ] = 0;
+			}
+		}
+
+		h->next_ = heaps_;
+		heaps_ = h;
+
+		return *h;
+	}
+
+	/**
+	 * Gets an empty chunk of the size class from the heap, and links it.
+	 */
+	chunk* reuse_chunk( heap& h, std::size_t size_class )
+	{
+		chunk* c = h.empty_[ size_class ];
+
+		if ( c )
+		{
+			h.empty_[ size_class ] = c->next_;
+			--h.empty_count_[ size_class ];
+		}
+		else
+		{
+			c = static_cast< chunk* >(
+				detail::allocate( h.functions_, chunk_size ) );
+
+			c->pool_ = this;
+			c->heap_ = &h;
+			c->free_ = nullptr;
+			c->size_class_ = size_class;
+			c->used_ = 0;
+			c->carved_ = 0;
+			c->capacity_ = ( chunk_size - sizeof( chunk ) ) /
+				block_stride( size_class );
+		}
+
+		link( c );
+
+		return c;
+	}
+
+	void deallocate_orphaned( void* ptr ) noexcept
+	{
+		std::unique_lock< std::mutex > lock( mutex_ );
+
+		auto emptied = free_local( ptr );
+
+		lock.unlock( );
+
+		if ( emptied )
+			release( );
+	}
+
+	/**
+	 * Frees a block into its chunk, and returns whether the chunk became
+	 * empty, in which case its reference to the pool is to be released.
+	 */
+	bool free_local( void* ptr ) noexcept
+	{
+		auto c = chunk_of( ptr );
+		auto block = static_cast< free_block* >( ptr );
+
+		block->next_ = c->free_;
+		c->free_ = block;
+
+		if ( c->used_-- == c->capacity_ )
+			link( c );
+
+		if ( c->used_ == 0 )
+		{
+			auto& h = *c->heap_;
+			auto size_class = c->size_class_;
+
+			unlink( c );
+
+			if ( h.empty_count_[ size_class ] < max_empty_chunks )
+			{
+				c->next_ = h.empty_[ size_class ];
+				h.empty_[ size_class ] = c;
+				++h.empty_count_[ size_class ];
+			}
+			else
+				free_chunk( c );
+
+			return true;
+		}
+
+		return false;
+	}
+
+	void take_remote( ) noexcept
+	{
+		until_drain_ = remote_drain_interval;
+
+		if ( remote_.load( std::memory_order_relaxed ) )
+			free_remote(
+				remote_.exchange( nullptr, std::memory_order_acquire ) );
+	}
+
+	void drain_periodically( ) noexcept
+	{
+		if ( --until_drain_ == 0 )
+			take_remote( );
+	}
+
+	/**
+	 * Frees remotely freed blocks into their chunks. This never releases
+	 * the last reference, as the caller holds the thread's reference.
+	 */
+	void free_remote( free_block* block ) noexcept
+	{
+		while ( block )
+		{
+			auto next = block->next_;
+			if ( free_local( block ) )
+				release( );
+			block = next;
+		}
+	}
+
+	void link( chunk* c ) noexcept
+	{
+		auto& head = c->heap_->partial_[ c->size_class_ ];
+
+		c->prev_ = nullptr;
+		c->next_ = head;
+		if ( head )
+			head->prev_ = c;
+		head = c;
+	}
+
+	void unlink( chunk* c ) noexcept
+	{
+		if ( c->prev_ )
+			c->prev_->next_ = c->next_;
+		else
+			c->heap_->partial_[ c->size_class_ ] = c->next_;
+
+		if ( c->next_ )
+			c->next_->prev_ = c->prev_;
+	}
+
+	static void free_chunk( chunk* c ) noexcept
+	{
+		detail::deallocate( c->heap_->functions_, c, chunk_size );
+	}
+
+	static void free_chunks( chunk* c ) noexcept
+	{
+		while ( c )
+		{
+			auto next = c->next_;
+			free_chunk( c );
+			c = next;
+		}
+	}
+
+	std::atomic< std::size_t > refs_;
+	std::atomic< free_block* > remote_;
+	std::mutex mutex_;
+	heap* heaps_;
+	std::size_t until_drain_;
+};
+
+// These are trivially destructible, so they can be used safely by other
+// thread-local objects' destructors, even after the pool is released.
+thread_local thread_pool* current_pool_ = nullptr;
+thread_local bool thread_exited_ = false;
+
+/**
+ * Releases the thread's reference to its pool when the thread exits.
+ */
+struct thread_pool_owner
+{
+	~thread_pool_owner( )
+	{
+		current_pool_ = nullptr;
+		thread_exited_ = true;
+
+		if ( pool_ )
+			pool_->orphan( );
+	}
+
+	thread_pool* pool_;
+};
+
+thread_local thread_pool_owner pool_owner_;
+
+thread_pool* get_current_pool( )
+{
+	if ( !current_pool_ && !thread_exited_ )
+	{
+		current_pool_ = new thread_pool;
+		pool_owner_.pool_ = current_pool_;
+	}
+
+	return current_pool_;
+}
+
+} // anonymous namespace
+
+void* pool_allocate( std::size_t size )
+{
+	if ( size > max_pooled_size )
+		return allocate( size );
+
+	auto pool = get_current_pool( );
+
+	if ( !pool )
+	{
+		// The thread is exiting, allocate a block without a pool
+		auto header = static_cast< block_header* >(
+			allocate( sizeof( block_header ) + size ) );
+		header->chunk_ = nullptr;
+		return header + 1;
+	}
+
+	return pool->allocate( current_functions( ), size_class_of( size ) );
+}
+
+void pool_deallocate( void* ptr, std::size_t size ) noexcept
+{
+	if ( size > max_pooled_size )
+	{
+		deallocate( ptr, size );
+		return;
+	}
+
+	auto header = static_cast< block_header* >( ptr ) - 1;
+
+	if ( !header->chunk_ )
+	{
+		deallocate( header, sizeof( block_header ) + size );
+		return;
+	}
+
+	auto pool = header->chunk_->pool_;
+
+	if ( pool == current_pool_ )
+		pool->deallocate_local( ptr );
+	else
+		pool->deallocate_remote( ptr );
+}
+
+} } // namespace detail, namespace q
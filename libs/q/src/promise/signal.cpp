@@ -18,6 +18,11 @@
 
 #include <q/mutex.hpp>
 #include <q/queue.hpp>
+#include <q/memory.hpp>
+#include <q/accounting.hpp>
+
+#include <algorithm>
+#include <functional>
 
 namespace q { namespace detail {
 
@@ -29,31 +34,150 @@ namespace {
  * They can also be synchronous tasks which run directly when the promise is
  * resolved. These must be tiny and fast and they must be 'noexcept'. This is
  * used for scheduling custom async tasks for event loops, e.g. timers.
+ *
+ * The tasks are stored apart from their targets, so that the tasks of a queue
+ * can be grouped in place and pushed to it at once.
  */
-struct item
+struct target
 {
-	task task_;
 	queue_ptr queue_;
-	bool synchronous_;
+	// The index of the task of this target, in the order they were added
+	std::size_t index_;
+	// The number of synchronous tasks added before this one
+	std::size_t segment_;
 };
 
+/**
+ * Synchronous tasks split the items into segments, which are kept in order,
+ * so that every task added before a synchronous task is run or pushed before
+ * it runs. Within a segment, the queued tasks are grouped per queue (in the
+ * order they were added), followed by the synchronous task ending it.
+ */
+bool operator<( const target& a, const target& b )
+{
+	if ( a.segment_ != b.segment_ )
+		return a.segment_ < b.segment_;
+	if ( !a.queue_ != !b.queue_ )
+		return !b.queue_;
+	return a.queue_ == b.queue_
+		? a.index_ < b.index_
+		: std::less< queue* >( )( a.queue_.get( ), b.queue_.get( ) );
+}
+
 } // anonymous namespace
 
 struct promise_signal::pimpl
 {
 	mutex mutex_;
 	bool done_;
-	std::vector< item > items_;
+	std::vector< task, allocator< task > > tasks_;
+	std::vector< target, allocator< target > > targets_;
+	std::size_t synchronous_items_;
+
+	// The number of items counted by object accounting
+	std::size_t accounted_items_;
+
+	static constexpr std::size_t item_size = sizeof( task ) + sizeof( target );
+
+	void add_item( task&& task, const queue_ptr& queue )
+	{
+		targets_.push_back(
+			target{ queue, tasks_.size( ), synchronous_items_ } );
+		tasks_.push_back( std::move( task ) );
+
+		if ( !queue )
+			++synchronous_items_;
+
+		if ( is_object_accounting_enabled( ) )
+		{
+			++accounted_items_;
+			account_objects(
+				accounted_object::continuation, 1, item_size );
+		}
+	}
+
+	/**
+	 * Sorts the items per queue, in the order they were added, within each
+	 * segment (see operator<). The targets are sorted, and the tasks are then
+	 * moved to their target's position by following the cycles of the
+	 * permutation.
+	 */
+	void group_items( )
+	{
+		if ( std::is_sorted( targets_.begin( ), targets_.end( ) ) )
+			return;
+
+		std::sort( targets_.begin( ), targets_.end( ) );
+
+		for ( std::size_t start = 0; start < targets_.size( ); ++start )
+		{
+			if ( targets_[ start ].index_ == start )
+				continue;
+
+			task first = std::move( tasks_[ start ] );
+			std::size_t pos = start;
+
+			while ( true )
+			{
+				auto from = targets_[ pos ].index_;
+				targets_[ pos ].index_ = pos;
+
+				if ( from == start )
+					break;
+
+				tasks_[ pos ] = std::move( tasks_[ from ] );
+				pos = from;
+			}
+
+			tasks_[ pos ] = std::move( first );
+		}
+	}
+
+	void release_accounted_items( )
+	{
+		if ( !accounted_items_ )
+			return;
+
+		auto count = static_cast< std::int64_t >( accounted_items_ );
+		account_objects(
+			accounted_object::continuation,
+			-count,
+			-count * static_cast< std::int64_t >( item_size ) );
+
+		accounted_items_ = 0;
+	}
 };
 
+constexpr std::size_t promise_signal::pimpl::item_size;
+
 promise_signal::promise_signal( )
+: promise_signal( false )
+{ }
+
+promise_signal::promise_signal( bool ready )
 : pimpl_( new pimpl )
+, ready_( ready )
 {
-	pimpl_->done_ = false;
+	pimpl_->done_ = ready;
+	pimpl_->synchronous_items_ = 0;
+	pimpl_->accounted_items_ = 0;
+}
+
+const promise_signal_ptr& promise_signal::ready( ) noexcept
+{
+	// Never destructed, as promises can outlive static destruction. It's
+	// allocated with the default allocator, not charged to the allocator
+	// functions of whichever context happens to use it first.
+	static auto signal = new promise_signal_ptr(
+		std::make_shared< shared_constructor< promise_signal > >( true ) );
+
+	return *signal;
 }
 
 promise_signal::~promise_signal( )
-{ }
+{
+	pimpl_->release_accounted_items( );
+}
 
 // TODO: Analyze noexcept here, when it comes to pushing to a queue which might
 //       be closed or similar.
@@ -65,26 +189,63 @@ void promise_signal::done( ) noexcept
 		pimpl_->done_ = true;
 	}
 
-	for ( auto& item : pimpl_->items_ )
+	auto& tasks = pimpl_->tasks_;
+	auto& targets = pimpl_->targets_;
+
+	if ( tasks.size( ) == 1 )
 	{
-		if ( item.synchronous_ )
-			item.task_( );
+		auto& queue = targets.front( ).queue_;
+
+		if ( !queue )
+			tasks.front( )( );
 		else
-			item.queue_->push( std::move( item.task_ ) );
+			queue->push( std::move( tasks.front( ) ) );
+	}
+	else if ( !tasks.empty( ) )
+	{
+		// Many continuations (typically of a shared promise) are likely
+		// to be on the same queue. They're grouped per queue, in order,
+		// and each group is pushed at once, to not lock the queue and
+		// notify its consumer once per continuation. Synchronous tasks
+		// still run after everything added before them is pushed.
+		pimpl_->group_items( );
+
+		std::size_t i = 0;
+		while ( i < tasks.size( ) )
+		{
+			auto& queue = targets[ i ].queue_;
+
+			if ( !queue )
+			{
+				tasks[ i++ ]( );
+				continue;
+			}
+
+			std::size_t end = i + 1;
+			while ( end < tasks.size( ) && targets[ end ].queue_ == queue )
+				++end;
+
+			queue->push_batch( &tasks[ i ], end - i );
+
+			i = end;
+		}
 	}
 
-	pimpl_->items_.clear( );
+	tasks.clear( );
+	targets.clear( );
+	pimpl_->synchronous_items_ = 0;
+	pimpl_->release_accounted_items( );
 }
 
 void promise_signal::push( task&& task, const queue_ptr& queue ) noexcept
 {
+	if ( !ready_ )
 	{
 		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_ );
 
 		if ( !pimpl_->done_ )
 		{
-			pimpl_->items_.push_back(
-				{ std::move( task ), queue, false } );
+			pimpl_->add_item( std::move( task ), queue );
 
 			return;
 		}
@@ -95,13 +256,13 @@ void promise_signal::push( task&& task, const queue_ptr& queue ) noexcept
 
 void promise_signal::push_synchronous( task&& task ) noexcept
 {
+	if ( !ready_ )
 	{
 		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_ );
 
 		if ( !pimpl_->done_ )
 		{
-			pimpl_->items_.push_back(
-				{ std::move( task ), nullptr, true } );
+			pimpl_->add_item( std::move( task ), nullptr );
 
 			return;
 		}
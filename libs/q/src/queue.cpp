@@ -15,14 +15,47 @@
  */
 
 #include <q/queue.hpp>
+#include <q/event_dispatcher.hpp>
 #include <q/mutex.hpp>
 #include <q/memory.hpp>
 #include <q/exception.hpp>
 
+#include "detail/task_storage.hpp"
+#include "detail/worker.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <queue>
 
 namespace q {
 
+namespace {
+
+/**
+ * The queues created while object accounting is enabled. Other queues never
+ * touch the registry, so creating and destroying queues doesn't take this
+ * process-wide lock unless accounting is in use. The queues are referenced
+ * weakly, so that they can be accounted without holding the registry lock,
+ * which a registered queue takes when it's destructed.
+ */
+struct queue_registry
+{
+	std::mutex mutex_;
+	std::map< queue*, std::weak_ptr< queue > > queues_;
+};
+
+queue_registry& get_queue_registry( )
+{
+	// Never destructed, as queues may outlive static destruction
+	static auto registry = new queue_registry;
+	return *registry;
+}
+
+} // anonymous namespace
+
 // TODO: Consider using a semaphore instead, and then preferably a non-locking
 // queue altogether. The only thing necessary is that two push-calls from the
 // same thread must follow order.
@@ -31,50 +64,153 @@ struct queue::pimpl
 	pimpl( priority_t priority )
 	: priority_( priority )
 	, mutex_( Q_HERE, "queue mutex" )
+	, dispatcher_( nullptr )
+	, notifying_( 0 )
+	, removing_( 0 )
+	, parked_( 0 )
 	, parallelism_( 1 )
+	, registered_( false )
 	{ }
 
+	/**
+	 * The consumer to notify after a push, which is taken with the queue
+	 * locked, and notified after it's unlocked.
+	 */
+	struct consumer_ref
+	{
+		basic_event_dispatcher* dispatcher_;
+		queue::notify_type fn_;
+	};
+
+	// Must be called with the queue locked
+	consumer_ref get_consumer( )
+	{
+		auto dispatcher = dispatcher_.load( std::memory_order_relaxed );
+
+		if ( !dispatcher )
+			return consumer_ref{ nullptr, notify_ };
+
+		// Keeps the dispatcher from being removed (and destructed)
+		// until it's notified. The dispatcher can't be notified with
+		// the queue locked instead, as dispatchers fetch tasks (and
+		// lock the queue) with their own lock held. This counter is
+		// only touched by pushes to this queue, which have the queue's
+		// cache line anyway, and costs no measurable time per push.
+		notifying_.fetch_add( 1, std::memory_order_relaxed );
+
+		return consumer_ref{ dispatcher, queue::notify_type( ) };
+	}
+
+	void notify( consumer_ref& consumer, std::size_t times )
+	{
+		if ( consumer.dispatcher_ )
+		{
+			for ( std::size_t i = 0; i < times; ++i )
+				consumer.dispatcher_->notify( );
+
+			// The last notification wakes up remove_consumer( ) if
+			// it waits for it
+			if ( notifying_.fetch_sub( 1 ) == 1 && removing_.load( ) )
+			{
+				{
+					Q_AUTO_UNIQUE_LOCK( mutex_ );
+				}
+				notified_.notify_all( );
+			}
+		}
+		else if ( consumer.fn_ )
+		{
+			for ( std::size_t i = 0; i < times; ++i )
+				consumer.fn_( );
+		}
+	}
+
 	const priority_t priority_;
 	mutex mutex_;
 	queue::notify_type notify_;
+	// Atomic to be readable without locking, see queue::push
+	std::atomic< basic_event_dispatcher* > dispatcher_;
+	std::atomic< std::size_t > notifying_;
+	// The number of remove_consumer( ) calls waiting on notified_
+	std::atomic< std::size_t > removing_;
+	std::condition_variable notified_;
+	// Tasks parked by workers rather than queued, see queue::push
+	std::atomic< std::size_t > parked_;
 	std::size_t parallelism_;
-	std::queue< task > queue_;
-	std::queue< timer_task > timer_task_queue_;
+	// Whether the queue is in the registry, for object accounting
+	bool registered_;
+	detail::task_storage queue_;
+	std::queue<
+		timer_task, std::deque< timer_task, allocator< timer_task > >
+	> timer_task_queue_;
 };
 
 queue_ptr queue::construct( priority_t priority )
 {
-	return make_shared_using_constructor< queue >( priority );
+	auto queue = make_shared_using_constructor< q::queue >( priority );
+
+	if ( is_object_accounting_enabled( ) )
+	{
+		auto& registry = get_queue_registry( );
+		std::unique_lock< std::mutex > lock( registry.mutex_ );
+
+		registry.queues_[ queue.get( ) ] = queue;
+		queue->pimpl_->registered_ = true;
+	}
+
+	return queue;
 }
 
 queue::queue( priority_t priority )
 : pimpl_( new pimpl( priority ) )
-{
-}
+{ }
 
 queue::~queue( )
 {
+	if ( !pimpl_->registered_ )
+		return;
+
+	auto& registry = get_queue_registry( );
+	std::unique_lock< std::mutex > lock( registry.mutex_ );
+
+	registry.queues_.erase( this );
 }
 
 void queue::push( task&& task )
 {
-	notify_type notifyer;
+	auto worker = detail::get_current_worker( );
+
+	if ( worker && worker->can_take_next( ) )
+	{
+		// A worker with affinity runs tasks it pushes to its own
+		// dispatcher's queues itself, as soon as its current task is
+		// done, without locking the queue or notifying the dispatcher.
+		auto dispatcher = pimpl_->dispatcher_.load(
+			std::memory_order_relaxed );
+
+		if (
+			dispatcher == worker->dispatcher_ &&
+			worker->park( task, *this, pimpl_->parked_ )
+		)
+			return;
+	}
+
+	pimpl::consumer_ref consumer;
 
 	{
 		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::push" );
 
 		pimpl_->queue_.push( std::move( task ) );
 
-		notifyer = pimpl_->notify_;
+		consumer = pimpl_->get_consumer( );
 	}
 
-	if ( notifyer )
-		notifyer( );
+	pimpl_->notify( consumer, 1 );
 }
 
 void queue::push( task&& task, timer::point_type wait_until )
 {
-	notify_type notifyer;
+	pimpl::consumer_ref consumer;
 
 	{
 		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::push(2)" );
@@ -82,11 +218,43 @@ void queue::push( task&& task, timer::point_type wait_until )
 		timer_task tt( std::move( task ), std::move( wait_until ) );
 		pimpl_->timer_task_queue_.push( std::move( tt ) );
 
-		notifyer = pimpl_->notify_;
+		consumer = pimpl_->get_consumer( );
+	}
+
+	pimpl_->notify( consumer, 1 );
+}
+
+void queue::push_batch( task* tasks, std::size_t count )
+{
+	if ( count == 0 )
+		return;
+
+	pimpl::consumer_ref consumer;
+	std::size_t notifications;
+
+	{
+		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::push_batch" );
+
+		for ( std::size_t i = 0; i < count; ++i )
+			pimpl_->queue_.push( std::move( tasks[ i ] ) );
+
+		consumer = pimpl_->get_consumer( );
+
+		// A dispatcher's workers pop tasks until the queue is empty, so
+		// it's only woken up once per worker which can run them
+		notifications = count;
+		if ( consumer.dispatcher_ )
+		{
+			auto parallelism = pimpl_->parallelism_
+				? pimpl_->parallelism_
+				: 1;
+
+			if ( parallelism < count )
+				notifications = parallelism;
+		}
 	}
 
-	if ( notifyer )
-		notifyer( );
+	pimpl_->notify( consumer, notifications );
 }
 
 priority_t queue::priority( ) const
@@ -99,9 +267,37 @@ void queue::set_consumer( queue::notify_type fn, std::size_t parallelism )
 	Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::set_consumer" );
 
 	pimpl_->notify_ = fn;
+	pimpl_->dispatcher_.store( nullptr, std::memory_order_relaxed );
 	pimpl_->parallelism_ = parallelism;
 }
 
+void queue::set_consumer( basic_event_dispatcher* dispatcher )
+{
+	Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::set_consumer(2)" );
+
+	pimpl_->notify_ = nullptr;
+	pimpl_->dispatcher_.store( dispatcher, std::memory_order_relaxed );
+	pimpl_->parallelism_ = dispatcher->parallelism( );
+}
+
+void queue::remove_consumer( )
+{
+	auto lock = Q_UNIQUE_LOCK(
+		pimpl_->mutex_, Q_HERE, "queue::remove_consumer" );
+
+	pimpl_->notify_ = nullptr;
+	pimpl_->dispatcher_.store( nullptr, std::memory_order_relaxed );
+
+	// Pushes which took the dispatcher before it was removed notify it
+	// after unlocking the queue, so wait for them
+	++pimpl_->removing_;
+
+	while ( pimpl_->notifying_.load( ) )
+		pimpl_->notified_.wait( lock );
+
+	--pimpl_->removing_;
+}
+
 bool queue::empty( )
 {
 	Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::empty" );
@@ -125,11 +321,7 @@ timer_task queue::pop( )
 	if ( pimpl_->queue_.empty( ) )
 		return timer_task( );
 
-	timer_task task = std::move( pimpl_->queue_.front( ) );
-
-	pimpl_->queue_.pop( );
-
-	return task;
+	return timer_task( pimpl_->queue_.pop( ) );
 }
 
 std::size_t queue::parallelism( ) const
@@ -137,4 +329,54 @@ std::size_t queue::parallelism( ) const
 	return pimpl_->parallelism_;
 }
 
+queue_accounting queue::accounting( )
+{
+	Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_, Q_HERE, "queue::accounting" );
+
+	auto timed = pimpl_->timer_task_queue_.size( );
+	auto parked = pimpl_->parked_.load( std::memory_order_relaxed );
+
+	queue_accounting accounting;
+	accounting.priority = pimpl_->priority_;
+	accounting.tasks.count = pimpl_->queue_.size( ) + timed + parked;
+	accounting.tasks.bytes = pimpl_->queue_.allocated_bytes( ) +
+		timed * sizeof( timer_task ) + parked * sizeof( task );
+
+	return accounting;
+}
+
+namespace detail {
+
+std::vector< queue_accounting > get_queue_accounting( )
+{
+	std::vector< std::weak_ptr< queue > > weak_queues;
+
+	{
+		auto& registry = get_queue_registry( );
+		std::unique_lock< std::mutex > lock( registry.mutex_ );
+
+		weak_queues.reserve( registry.queues_.size( ) );
+
+		for ( auto& entry : registry.queues_ )
+			weak_queues.push_back( entry.second );
+	}
+
+	// The queues are locked one by one without the registry locked, as
+	// a queue may be destructed (locking the registry) by a thread which
+	// holds another queue's lock.
+	std::vector< queue_accounting > queues;
+	queues.reserve( weak_queues.size( ) );
+
+	for ( auto& weak_queue : weak_queues )
+	{
+		auto queue = weak_queue.lock( );
+		if ( queue )
+			queues.push_back( queue->accounting( ) );
+	}
+
+	return queues;
+}
+
+} // namespace detail
+
 } // namespace q
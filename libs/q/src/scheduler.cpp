@@ -207,6 +207,8 @@ struct priority_scheduler::pimpl
 
 	weak_event_dispatcher_ptr event_dispatcher_;
 	round_robin_priority_list< priority_t, queue_ptr > queues_;
+	// The queues which are consumed by (and refer to) the dispatcher
+	std::vector< queue_ptr > consumed_queues_;
 };
 
 
@@ -222,17 +224,14 @@ void priority_scheduler::add_queue( queue_ptr queue )
 {
 	pimpl_->queues_.add( queue->priority( ), queue_ptr( queue ) );
 
-	weak_event_dispatcher_ptr wed = pimpl_->event_dispatcher_;
-	event_dispatcher_ptr ed = wed.lock( );
-	queue->set_consumer( [ wed ]( )
-	{
-		auto ed = wed.lock( );
+	event_dispatcher_ptr ed = pimpl_->event_dispatcher_.lock( );
 
-		if ( ed )
-			ed->notify( );
-		else
-		{ } // TODO: Warn or error somehow
-	}, ed->parallelism( ) );
+	// The queue refers to the dispatcher without a reference count, to not
+	// touch a shared reference count on every push. It's removed from the
+	// queue when this scheduler is unloaded, before the dispatcher is
+	// destructed.
+	queue->set_consumer( ed.get( ) );
+	pimpl_->consumed_queues_.push_back( queue );
 
 	auto _this = shared_from_this( );
 
@@ -245,6 +244,10 @@ void priority_scheduler::add_queue( queue_ptr queue )
 
 	auto unloader = [ _this ]( ) mutable
 	{
+		for ( auto& queue : _this->pimpl_->consumed_queues_ )
+			queue->remove_consumer( );
+
+		_this->pimpl_->consumed_queues_.clear( );
 		_this->pimpl_->queues_.clear( );
 	};
 
@@ -282,16 +285,8 @@ void direct_scheduler::add_queue( queue_ptr queue )
 	{
 		pimpl_->queue_ = queue;
 
-		auto wed = pimpl_->event_dispatcher_;
-		queue->set_consumer( [ wed ]( )
-		{
-			auto ed = wed.lock( );
-
-			if ( ed )
-				ed->notify( );
-			else
-			{ } // TODO: Warn or error somehow
-		}, ed->parallelism( ) );
+		// See priority_scheduler::add_queue
+		queue->set_consumer( ed.get( ) );
 	}
 	else
 	{
@@ -309,6 +304,9 @@ void direct_scheduler::add_queue( queue_ptr queue )
 
 	auto unloader = [ _this ]( ) mutable
 	{
+		if ( _this->pimpl_->queue_ )
+			_this->pimpl_->queue_->remove_consumer( );
+
 		_this->pimpl_->queue_.reset( );
 	};
 
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <q/spill.hpp>
+#include <q/endian.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+
+namespace q {
+
+struct spill_file::pimpl
+{
+	pimpl( const std::string& path, std::size_t compact_threshold )
+	: path_( path )
+	, compact_threshold_( static_cast< std::streamoff >(
+		compact_threshold ) )
+	, read_offset_( 0 )
+	, write_offset_( 0 )
+	, records_( 0 )
+	{
+		open( );
+	}
+
+	~pimpl( )
+	{
+		file_.close( );
+		std::remove( path_.c_str( ) );
+	}
+
+	void open( )
+	{
+		file_.close( );
+		file_.clear( );
+		file_.open(
+			path_,
+			std::ios::in | std::ios::out |
+			std::ios::binary | std::ios::trunc );
+
+		if ( !file_ )
+			Q_THROW( spill_file_exception( ) );
+
+		read_offset_ = 0;
+		write_offset_ = 0;
+	}
+
+	/**
+	 * Moves the unread records to a new file which replaces this one, once
+	 * the read part is large, and at least as large as the unread part.
+	 * The copying is thereby amortized over the reads, and the file never
+	 * grows much beyond twice the largest backlog, even if it's never
+	 * fully drained.
+	 */
+	void compact_if_needed( )
+	{
+		if (
+			read_offset_ < compact_threshold_ ||
+			read_offset_ < write_offset_ - read_offset_
+		)
+			return;
+
+		const std::string tmp_path = path_ + ".compact";
+
+		{
+			std::ofstream tmp(
+				tmp_path, std::ios::binary | std::ios::trunc );
+
+			char buf[ 64 * 1024 ];
+			auto left = write_offset_ - read_offset_;
+
+			file_.seekg( read_offset_ );
+			while ( left > 0 && file_ && tmp )
+			{
+				auto chunk = std::min(
+					left,
+					static_cast< std::streamoff >( sizeof buf ) );
+
+				file_.read( buf, chunk );
+				tmp.write( buf, chunk );
+				left -= chunk;
+			}
+
+			tmp.close( );
+
+			if ( !file_ || !tmp )
+			{
+				std::remove( tmp_path.c_str( ) );
+				Q_THROW( spill_file_exception( ) );
+			}
+		}
+
+		file_.close( );
+
+		if ( std::rename( tmp_path.c_str( ), path_.c_str( ) ) != 0 )
+			Q_THROW( spill_file_exception( ) );
+
+		file_.clear( );
+		file_.open(
+			path_, std::ios::in | std::ios::out | std::ios::binary );
+
+		if ( !file_ )
+			Q_THROW( spill_file_exception( ) );
+
+		write_offset_ -= read_offset_;
+		read_offset_ = 0;
+	}
+
+	const std::string path_;
+	const std::streamoff compact_threshold_;
+	std::fstream file_;
+	std::streamoff read_offset_;
+	std::streamoff write_offset_;
+	std::size_t records_;
+};
+
+spill_file::spill_file(
+	const std::string& path, std::size_t compact_threshold )
+: pimpl_( new pimpl( path, compact_threshold ) )
+{ }
+
+spill_file::~spill_file( )
+{ }
+
+void spill_file::append( const std::string& record )
+{
+	le< std::uint64_t > length( record.size( ) );
+
+	auto& file = pimpl_->file_;
+
+	file.seekp( pimpl_->write_offset_ );
+	file.write(
+		reinterpret_cast< const char* >( &length ), sizeof length );
+	file.write( record.data( ), record.size( ) );
+
+	if ( !file )
+		Q_THROW( spill_file_exception( ) );
+
+	pimpl_->write_offset_ += sizeof length + record.size( );
+	++pimpl_->records_;
+}
+
+bool spill_file::read( std::string& record )
+{
+	if ( pimpl_->records_ == 0 )
+		return false;
+
+	le< std::uint64_t > length;
+
+	auto& file = pimpl_->file_;
+
+	file.flush( );
+	file.seekg( pimpl_->read_offset_ );
+	file.read( reinterpret_cast< char* >( &length ), sizeof length );
+
+	record.resize( static_cast< std::uint64_t >( length ) );
+	file.read( &record[ 0 ], record.size( ) );
+
+	if ( !file )
+		Q_THROW( spill_file_exception( ) );
+
+	pimpl_->read_offset_ += sizeof length + record.size( );
+
+	if ( --pimpl_->records_ == 0 )
+		// Everything is read, start over from an empty file
+		pimpl_->open( );
+	else
+		pimpl_->compact_if_needed( );
+
+	return true;
+}
+
+std::size_t spill_file::size( ) const
+{
+	return pimpl_->records_;
+}
+
+} // namespace q
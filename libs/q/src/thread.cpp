@@ -18,6 +18,7 @@
 #include <q/pp.hpp>
 
 #include "detail/cpu.hpp"
+#include "detail/worker.hpp"
 
 #ifdef LIBQ_ON_WINDOWS
 #	include <windows.h>
@@ -176,14 +177,31 @@ std::string get_thread_name( )
 #endif // LIBQ_ON_POSIX
 }
 
+constexpr std::chrono::milliseconds worker_context::steal_after;
+
+namespace {
+
+thread_local worker_context* current_worker_ = nullptr;
+
+} // anonymous namespace
+
+worker_context* get_current_worker( ) noexcept
+{
+	return current_worker_;
+}
+
+void set_current_worker( worker_context* worker ) noexcept
+{
+	current_worker_ = worker;
+}
+
 } // namespace detail
 
-/*
-thread* thread::current( )
+basic_event_dispatcher* current_event_dispatcher( ) noexcept
 {
-	// TODO: TLS Lookup, or nullptr
-	return nullptr;
+	auto worker = detail::current_worker_;
+
+	return worker ? worker->dispatcher_ : nullptr;
 }
-*/
 
 } // namespace q
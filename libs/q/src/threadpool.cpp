@@ -18,11 +18,15 @@
 #include <q/mutex.hpp>
 #include <q/time_set.hpp>
 
+#include "detail/worker.hpp"
+
 #include <thread>
 #include <queue>
 #include <condition_variable>
+#include <deque>
 #include <sstream>
 #include <set>
+#include <algorithm>
 
 namespace q {
 
@@ -54,6 +58,9 @@ struct threadpool::pimpl
 	, started_( false )
 	, running_( false )
 	, stop_asap_( false )
+	, worker_affinity_( false )
+	, idle_workers_( 0 )
+	, wakeups_( 0 )
 	{ }
 
 	typedef std::shared_ptr< thread< > > thread_type;
@@ -68,7 +75,22 @@ struct threadpool::pimpl
 	std::condition_variable    cond_;
 	bool                       started_;
 	bool                       running_;
-	bool                       stop_asap_;
+	// Atomic to be readable by workers between the tasks they run
+	std::atomic< bool >        stop_asap_;
+	std::atomic< bool >        worker_affinity_;
+	// The workers, and how many of them wait for tasks, for the workers
+	// which park tasks (with worker affinity) and those stealing them.
+	// The worker contexts are created up front and live as long as the
+	// pool, so that idle workers can look for parked tasks unlocked. They
+	// are over-aligned (by their parked task), so they're allocated by
+	// q's allocator, and never moved once created.
+	std::deque<
+		detail::worker_context, allocator< detail::worker_context >
+	> workers_;
+	std::atomic< std::size_t > idle_workers_;
+	// Incremented (locked) when the workers are notified, for workers
+	// which unlock before waiting, to know if they missed a notification
+	std::size_t wakeups_;
 	task_fetcher_task          task_fetcher_;
 	task                       scheduler_unloader_;
 	time_set< task >           timer_tasks_;
@@ -83,6 +105,9 @@ threadpool::threadpool( const std::string& name,
 	pimpl_->running_ = true;
 	pimpl_->started_ = true;
 	pimpl_->threads_.reserve( threads );
+
+	for ( std::size_t i = 0; i < threads; ++i )
+		pimpl_->workers_.emplace_back( this, &pimpl_->idle_workers_ );
 }
 
 threadpool::~threadpool( )
@@ -103,6 +128,7 @@ threadpool::construct( const std::string& name,
 void threadpool::notify( )
 {
 	Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_ );
+	++pimpl_->wakeups_;
 	pimpl_->cond_.notify_one( );
 }
 
@@ -112,6 +138,7 @@ void threadpool::set_task_fetcher( task_fetcher_task&& fetcher )
 
 	{
 		Q_AUTO_UNIQUE_LOCK( pimpl_->mutex_ );
+		++pimpl_->wakeups_;
 	}
 	pimpl_->cond_.notify_all( );
 }
@@ -126,6 +153,11 @@ std::size_t threadpool::parallelism( ) const
 	return pimpl_->num_threads_;
 }
 
+void threadpool::set_worker_affinity( bool enabled )
+{
+	pimpl_->worker_affinity_.store( enabled, std::memory_order_relaxed );
+}
+
 promise< > threadpool::start( )
 {
 	auto _this = shared_from_this( );
@@ -144,9 +176,27 @@ promise< > threadpool::start( )
 		{
 			auto& pimpl_ = _this->pimpl_;
 
+			auto& worker = pimpl_->workers_[ index ];
+			detail::set_current_worker( &worker );
+
 			auto lock = Q_UNIQUE_LOCK( pimpl_->mutex_ );
 
-			auto invoker = [ ]( task&& elem )
+			auto stop = [ &pimpl_ ]( )
+			{
+				return pimpl_->stop_asap_.load(
+					std::memory_order_relaxed );
+			};
+
+			// The task parked by another worker which this worker
+			// will steal, if it's still parked at steal_at
+			detail::worker_context* steal_from = nullptr;
+			std::size_t steal_park = 0;
+			timer::point_type steal_at;
+
+			// The task is taken by value, to be destructed before
+			// re-locking, as destructing it can settle promises
+			// (abandoned defers) and thereby notify this pool.
+			auto invoker = [ ]( task elem )
 			{
 				try
 				{
@@ -174,7 +224,12 @@ promise< > threadpool::start( )
 					{
 						Q_AUTO_UNIQUE_UNLOCK( lock );
 
-						invoker( std::move( task ) );
+						worker.run(
+							std::move( task ),
+							pimpl_->worker_affinity_.load(
+								std::memory_order_relaxed ),
+							stop,
+							invoker );
 
 						continue;
 					}
@@ -204,28 +259,126 @@ promise< > threadpool::start( )
 				{
 					Q_AUTO_UNIQUE_UNLOCK( lock );
 
-					invoker( std::move( _task.task_ ) );
+					worker.run(
+						std::move( _task.task_ ),
+						pimpl_->worker_affinity_.load(
+							std::memory_order_relaxed ),
+						stop,
+						invoker );
+
+					continue;
 				}
 
 				if ( pimpl_->running_ && !_task )
 				{
-					if ( !pimpl_->timer_tasks_.empty( ) )
+					// Counted as idle before looking for parked
+					// tasks, so that a worker parking a task
+					// after this will wake it up.
+					pimpl_->idle_workers_.fetch_add( 1 );
+
+					auto wakeups = pimpl_->wakeups_;
+					auto now = timer::point_type::clock::now( );
+					bool parked = false;
+					bool stole = false;
+					task stolen;
+					queue_ptr stolen_queue;
+
 					{
-						auto next = pimpl_->timer_tasks_
-							.next_time( );
+						// The other workers' park numbers are
+						// atomic, so idle workers look for parked
+						// tasks without holding up the pool
+						Q_AUTO_UNIQUE_UNLOCK( lock );
+
+						for ( auto& other_ref : pimpl_->workers_ )
+						{
+							auto other = &other_ref;
+							auto park = other == &worker
+								? 0
+								: other->parked( );
+
+							if ( !park )
+								continue;
+
+							parked = true;
+
+							if (
+								other != steal_from ||
+								park != steal_park
+							)
+							{
+								steal_from = other;
+								steal_park = park;
+								steal_at = now + detail::
+									worker_context::
+									steal_after;
+							}
+							else if (
+								now >= steal_at &&
+								!other->steal(
+									park,
+									stolen,
+									stolen_queue )
+							)
+							{
+								// Taken by its worker in the
+								// meantime, nothing to wait for
+								parked = false;
+								steal_from = nullptr;
+							}
+
+							break;
+						}
 
-						if ( next != duration_max )
+						if ( stolen )
 						{
-							pimpl_->cond_.wait_for(
-								lock, next );
-							continue;
+							stole = true;
+							pimpl_->idle_workers_.fetch_sub( 1 );
+							steal_from = nullptr;
+
+							// Pushed back to its queue, where
+							// it's run in order by any worker
+							stolen_queue->push(
+								std::move( stolen ) );
+							stolen_queue.reset( );
 						}
 					}
-					pimpl_->cond_.wait( lock );
+
+					if ( stole )
+						continue;
+
+					// Tasks pushed or a termination while the
+					// pool was unlocked are taken care of first
+					if ( pimpl_->wakeups_ != wakeups )
+					{
+						pimpl_->idle_workers_.fetch_sub( 1 );
+						continue;
+					}
+
+					auto wait = pimpl_->timer_tasks_.empty( )
+						? duration_max
+						: pimpl_->timer_tasks_.next_time( );
+
+					// Never less than a millisecond, to not spin
+					// if the stealing time has just passed
+					if ( parked )
+						wait = std::min< timer::duration_type >(
+							wait,
+							std::max< timer::duration_type >(
+								steal_at - now,
+								std::chrono::milliseconds( 1 ) ) );
+
+					if ( wait != duration_max )
+						pimpl_->cond_.wait_for( lock, wait );
+					else
+						pimpl_->cond_.wait( lock );
+
+					pimpl_->idle_workers_.fetch_sub( 1 );
 				}
 			}
 			while ( true );
 
+			detail::set_current_worker( nullptr );
+
 			_this->mark_completion( );
 		};
 
@@ -275,6 +428,8 @@ void threadpool::do_terminate( termination method )
 
 		if ( method != q::termination::linger )
 			pimpl_->stop_asap_ = true;
+
+		++pimpl_->wakeups_;
 	}
 
 	pimpl_->cond_.notify_all( );
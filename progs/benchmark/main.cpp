@@ -326,6 +326,37 @@ void benchmark_tasks_on_threadpool( std::size_t iterations, bool parallel )
 	std::cout << std::endl;
 }
 
+void benchmark_ready_promises( std::size_t iterations )
+{
+	benchmark_title( "creating settled promises" );
+
+	auto queue = q::make_shared< q::queue >( 0 );
+
+	q::timer::duration_type total_dur( 0 );
+
+	{
+		auto timer_scope = make_benchmark_timer(
+			total_dur, iterations, "Settling a defer< int >" );
+
+		for ( std::size_t i = 0; i < iterations; ++i )
+		{
+			auto deferred = q::detail::defer< int >::construct( queue );
+			deferred->set_value( static_cast< int >( i ) );
+			auto promise = deferred->get_promise( );
+		}
+	}
+
+	{
+		auto timer_scope = make_benchmark_timer(
+			total_dur, iterations, "q::with( queue, int )" );
+
+		for ( std::size_t i = 0; i < iterations; ++i )
+			auto promise = q::with( queue, static_cast< int >( i ) );
+	}
+
+	std::cout << std::endl;
+}
+
 int main( int, char** )
 {
 	q::settings settings;
@@ -340,6 +371,8 @@ int main( int, char** )
 	benchmark_q_function< std::function >( fn_iterations, "std::function" );
 	benchmark_q_function< q::function >( fn_iterations, "q::function" );
 
+	benchmark_ready_promises( iterations * 4 );
+
 	benchmark_tasks_on_main_queue( iterations, true );
 	benchmark_tasks_on_threadpool( iterations, true );
 
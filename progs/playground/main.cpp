@@ -15,6 +15,7 @@
 
 #include <string>
 #include <iostream>
+#include <thread>
 
 template< typename... Args >
 void noop( Args&&... ) { }
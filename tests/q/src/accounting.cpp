@@ -0,0 +1,98 @@
+
+#include <q/accounting.hpp>
+#include <q/channel.hpp>
+
+#include <sstream>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( accounting );
+
+TEST_F( accounting, queued_tasks )
+{
+	q::set_object_accounting( true );
+
+	auto tasks = q::queue::construct( 0 );
+
+	EXPECT_EQ( 0U, tasks->accounting( ).tasks.count );
+
+	tasks->push( [ ]( ) { } );
+	tasks->push( [ ]( ) { } );
+
+	EXPECT_EQ( 2U, tasks->accounting( ).tasks.count );
+	EXPECT_LT( 0U, tasks->accounting( ).tasks.bytes );
+
+	auto snapshot = q::get_object_accounting( );
+	EXPECT_LE( 2U, snapshot.queued_tasks.count );
+
+	tasks->pop( ).task_( );
+	tasks->pop( ).task_( );
+
+	EXPECT_EQ( 0U, tasks->accounting( ).tasks.count );
+
+	q::set_object_accounting( false );
+}
+
+TEST_F( accounting, queues_are_registered_only_when_enabled )
+{
+	auto before = q::get_object_accounting( ).queues.size( );
+
+	auto unaccounted = q::queue::construct( 0 );
+	EXPECT_EQ( before, q::get_object_accounting( ).queues.size( ) );
+
+	q::set_object_accounting( true );
+	auto accounted = q::queue::construct( 0 );
+	q::set_object_accounting( false );
+
+	EXPECT_EQ( before + 1, q::get_object_accounting( ).queues.size( ) );
+
+	accounted.reset( );
+	EXPECT_EQ( before, q::get_object_accounting( ).queues.size( ) );
+}
+
+TEST_F( accounting, live_objects )
+{
+	q::set_object_accounting( true );
+	EXPECT_TRUE( q::is_object_accounting_enabled( ) );
+
+	auto before = q::get_object_accounting( );
+
+	{
+		auto deferred = q::detail::defer< int >::construct( queue );
+
+		auto promise = deferred->get_promise( )
+		.then( [ ]( int ) { } );
+
+		q::channel< int > ch( queue, 5 );
+		auto writable = ch.get_writable( );
+		EXPECT_TRUE( writable.write( 1 ) );
+		EXPECT_TRUE( writable.write( 2 ) );
+
+		auto during = q::get_object_accounting( );
+
+		EXPECT_TRUE( during.enabled );
+		EXPECT_LE( before.defers.count + 2, during.defers.count );
+		EXPECT_LT( before.defers.bytes, during.defers.bytes );
+		EXPECT_LE(
+			before.continuations.count + 1,
+			during.continuations.count );
+		EXPECT_EQ(
+			before.channel_elements.count + 2,
+			during.channel_elements.count );
+
+		std::stringstream ss;
+		ss << during;
+		EXPECT_NE( std::string::npos, ss.str( ).find( "defers" ) );
+
+		deferred->set_value( 1 );
+		run( std::move( promise ) );
+	}
+
+	auto after = q::get_object_accounting( );
+
+	EXPECT_EQ( before.defers.count, after.defers.count );
+	EXPECT_EQ( before.continuations.count, after.continuations.count );
+	EXPECT_EQ( before.channel_elements.count, after.channel_elements.count );
+
+	q::set_object_accounting( false );
+}
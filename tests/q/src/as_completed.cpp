@@ -0,0 +1,63 @@
+#include <q/as_completed.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( as_completed );
+
+TEST_F( as_completed, results_in_settle_order_with_index )
+{
+	q::channel< int > ch( queue, 1 );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( ch.get_readable( ).read( ) );
+	promises.push_back( q::with( queue, 1 ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+
+	auto readable = q::as_completed( std::move( promises ), queue );
+
+	auto writable = ch.get_writable( );
+	auto received = std::make_shared< std::vector< std::size_t > >( );
+
+	auto promise = readable.consume(
+		[ writable, received ]( std::size_t index, q::expect< int > value )
+		mutable
+		{
+			received->push_back( index );
+
+			if ( index == 0 )
+				EXPECT_EQ( 5, value.get( ) );
+			else if ( index == 1 )
+				EXPECT_EQ( 1, value.get( ) );
+			else
+			{
+				EXPECT_TRUE( value.has_exception( ) );
+
+				// Settle the first promise last
+				EXPECT_TRUE( writable.write( 5 ) );
+			}
+		}
+	)
+	.then( [ received ]( )
+	{
+		EXPECT_EQ(
+			std::vector< std::size_t >( { 1, 2, 0 } ),
+			*received );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( as_completed, empty_list_is_closed )
+{
+	std::vector< q::promise< > > promises;
+
+	auto readable = q::as_completed( std::move( promises ), queue );
+
+	run(
+		readable.consume(
+			EXPECT_NO_CALL_WRAPPER(
+				[ ]( std::size_t, q::expect< void > ) { }
+			)
+		)
+	);
+}
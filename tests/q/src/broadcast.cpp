@@ -0,0 +1,158 @@
+#include <q/broadcast.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( broadcast );
+
+Q_MAKE_SIMPLE_EXCEPTION( test_exception );
+
+TEST_F( broadcast, all_readers_get_all_values )
+{
+	q::broadcast_channel< int, std::string > ch( queue, 10 );
+
+	auto r1 = ch.subscribe( );
+	auto r2 = ch.subscribe( );
+	auto w = ch.get_writable( );
+
+	EXPECT_EQ( std::size_t( 2 ), ch.readers( ) );
+
+	auto sum1 = std::make_shared< int >( 0 );
+	auto sum2 = std::make_shared< int >( 0 );
+
+	for ( int i = 1; i <= 4; ++i )
+		EXPECT_TRUE( w.write( i, "x" ) );
+	w.close( );
+
+	auto promise = q::all(
+		r1.consume( [ sum1 ]( const int& i, const std::string& s )
+		{
+			EXPECT_EQ( "x", s );
+			*sum1 += i;
+		} ),
+		r2.consume( [ sum2 ]( const int& i, const std::string& )
+		{
+			*sum2 += i;
+		} )
+	)
+	.then( [ sum1, sum2 ]( )
+	{
+		EXPECT_EQ( 10, *sum1 );
+		EXPECT_EQ( 10, *sum2 );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( broadcast, elements_are_shared )
+{
+	q::broadcast_channel< int > ch( queue, 10 );
+
+	auto r1 = ch.subscribe( );
+	auto r2 = ch.subscribe( );
+
+	EXPECT_TRUE( ch.get_writable( ).write( 5 ) );
+
+	typedef q::broadcast_readable< int >::element_type element_type;
+
+	auto promise = r1.read( )
+	.then( [ r2 ]( element_type e1 ) mutable
+	{
+		return r2.read( )
+		.then( [ e1 ]( element_type e2 )
+		{
+			EXPECT_EQ( e1.get( ), e2.get( ) );
+			EXPECT_EQ( 5, std::get< 0 >( *e2 ) );
+		} );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( broadcast, backpressure_from_slowest_reader )
+{
+	q::broadcast_channel< int > ch( queue, 2, 1 );
+
+	auto fast = ch.subscribe( );
+	auto slow = ch.subscribe( );
+	auto w = ch.get_writable( );
+
+	EXPECT_TRUE( w.write( 1 ) );
+	EXPECT_TRUE( w.should_write( ) );
+	EXPECT_TRUE( w.write( 2 ) );
+	EXPECT_FALSE( w.should_write( ) );
+
+	auto promise = fast.read( )
+	.then( [ fast ]( q::broadcast_readable< int >::element_type ) mutable
+	{
+		return fast.read( );
+	} )
+	.then( [ w, slow ]( q::broadcast_readable< int >::element_type )
+	mutable
+	{
+		// The fast reader has read everything, but the slow one
+		// still holds the writer back.
+		EXPECT_FALSE( w.should_write( ) );
+
+		return slow.read( );
+	} )
+	.then( [ w, slow ]( q::broadcast_readable< int >::element_type )
+	mutable
+	{
+		return slow.read( );
+	} )
+	.then( [ w ]( q::broadcast_readable< int >::element_type )
+	{
+		EXPECT_TRUE( w.should_write( ) );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( broadcast, drop_slow_readers )
+{
+	q::broadcast_channel< int > ch(
+		queue, 2, q::broadcast_overflow::drop_slow_readers );
+
+	auto fast = ch.subscribe( );
+	auto slow = ch.subscribe( );
+	auto w = ch.get_writable( );
+
+	auto promise = fast.read( )
+	.then( [ fast, w ]( q::broadcast_readable< int >::element_type )
+	mutable
+	{
+		EXPECT_TRUE( w.write( 2 ) );
+		EXPECT_TRUE( w.should_write( ) );
+		return fast.read( );
+	} )
+	.then( [ slow ]( q::broadcast_readable< int >::element_type )
+	mutable
+	{
+		return slow.read( );
+	} )
+	.then( EXPECT_NO_CALL_WRAPPER(
+		[ ]( q::broadcast_readable< int >::element_type ) { }
+	) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( q::broadcast_lagged_exception& ) { }
+	) );
+
+	EXPECT_TRUE( w.write( 1 ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( broadcast, close_with_exception )
+{
+	q::broadcast_channel< int > ch( queue, 2 );
+
+	auto r = ch.subscribe( );
+
+	auto promise = r.consume( EXPECT_NO_CALL_WRAPPER( [ ]( const int& ) { } ) )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER( [ ]( test_exception& ) { } ) );
+
+	ch.get_writable( ).close( test_exception( ) );
+
+	run( std::move( promise ) );
+}
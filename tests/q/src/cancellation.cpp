@@ -0,0 +1,88 @@
+#include <q/cancellation.hpp>
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( cancellation );
+
+TEST_F( cancellation, wrapped_functions_are_skipped_when_cancelled )
+{
+	q::cancellation token;
+
+	EXPECT_FALSE( token.is_cancelled( ) );
+
+	auto promise = q::with( queue, 1 )
+	.then( token.wrap( [ token ]( int i ) mutable
+	{
+		token.cancel( );
+		return i + 1;
+	} ) )
+	.then( token.wrap( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) ) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( const q::cancellation_exception& ) { }
+	) );
+
+	run( std::move( promise ) );
+
+	EXPECT_TRUE( token.is_cancelled( ) );
+}
+
+TEST_F( cancellation, guarded_promise_is_rejected_directly )
+{
+	q::cancellation token;
+	q::channel< int > ch( queue, 1 );
+
+	auto promise = token.guard( ch.get_readable( ).read( ) )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( const q::cancellation_exception& ) { }
+	) );
+
+	token.cancel( );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( cancellation, on_cancel_after_cancel_is_called_directly )
+{
+	q::cancellation token;
+
+	int called = 0;
+	token.on_cancel( [ &called ]( ) { ++called; } );
+
+	token.cancel( );
+	token.cancel( );
+	EXPECT_EQ( 1, called );
+
+	token.on_cancel( [ &called ]( ) { ++called; } );
+	EXPECT_EQ( 2, called );
+
+	EXPECT_THROW( token.throw_if_cancelled( ), q::cancellation_exception );
+}
+
+TEST_F( cancellation, expired_registrations_are_dropped )
+{
+	q::cancellation token;
+
+	auto captured = std::make_shared< int >( 0 );
+	std::weak_ptr< int > weak_captured = captured;
+
+	{
+		auto owner = std::make_shared< int >( 0 );
+		token.on_cancel( [ captured ]( ) { ADD_FAILURE( ); }, owner );
+		captured.reset( );
+	}
+
+	EXPECT_FALSE( weak_captured.expired( ) );
+
+	int called = 0;
+	auto owner = std::make_shared< int >( 0 );
+
+	for ( std::size_t i = 0; i < 100; ++i )
+		token.on_cancel( [ &called ]( ) { ++called; }, owner );
+
+	EXPECT_TRUE( weak_captured.expired( ) );
+
+	token.cancel( );
+	EXPECT_EQ( 100, called );
+}
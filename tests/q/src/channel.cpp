@@ -1267,3 +1267,75 @@ TEST_F( channel, writable_destruction_should_close )
 		readable.read( ), q::channel_closed_exception );
 	EXPECT_TRUE( readable.is_closed( ) );
 }
+
+TEST_F( channel, adaptive_buffer_count )
+{
+	q::channel< int > ch( queue, q::adaptive_buffer_count( 2, 16 ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	EXPECT_EQ( std::size_t( 2 ), writable.buffer_count( ) );
+
+	// The writer gets paused without any reader waiting, the buffer grows
+	for ( int i = 0; i < 4; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+
+	EXPECT_EQ( std::size_t( 4 ), writable.buffer_count( ) );
+
+	std::vector< q::promise< int > > reads;
+
+	for ( int i = 0; i < 4; ++i )
+		reads.push_back( readable.read( ) );
+
+	// Readers are waiting for data, while the writer isn't paused, the
+	// buffer shrinks
+	for ( int i = 4; i < 8; ++i )
+	{
+		reads.push_back( readable.read( ) );
+		EXPECT_TRUE( writable.write( i ) );
+	}
+
+	EXPECT_EQ( std::size_t( 2 ), writable.buffer_count( ) );
+
+	run(
+		q::all( std::move( reads ), queue )
+		.then( [ ]( std::vector< int > values )
+		{
+			ASSERT_EQ( std::size_t( 8 ), values.size( ) );
+			for ( int i = 0; i < 8; ++i )
+				EXPECT_EQ( i, values[ i ] );
+		} )
+	);
+}
+
+TEST_F( channel, closed_exception_is_preallocated )
+{
+	q::channel< int > ch( queue, 1 );
+	ch.get_writable( ).close( );
+
+	auto readable = ch.get_readable( );
+	auto first = std::make_shared< std::exception_ptr >( );
+
+	auto promise = readable.read( )
+	.fail( [ first ]( std::exception_ptr e ) -> int
+	{
+		*first = e;
+		return 0;
+	} )
+	.then( [ readable ]( int ) mutable
+	{
+		return readable.read( );
+	} )
+	.fail( [ first ]( std::exception_ptr e ) -> int
+	{
+		EXPECT_TRUE( !!*first );
+		EXPECT_EQ( *first, e );
+		EXPECT_EQ(
+			q::static_exception_ptr< q::channel_closed_exception >( ),
+			e );
+		return 0;
+	} );
+
+	run( std::move( promise ) );
+}
@@ -913,3 +913,56 @@ TEST( function, large_mutable_non_copyable_lambda_unique_shared_conversion )
 	_uf( );
 	EXPECT_EQ( 3, call_count );
 }
+
+TEST( function, compact_and_call_in_place )
+{
+	typedef q::unique_function< void( ) > function_type;
+
+	call_count = 0;
+
+	function_type functions[ ] = {
+		function_type( plain ),
+		function_type( make_lambda_11_size< 8, true, false >( ) ),
+		function_type( make_lambda_11_size< 256, true, false >( ) ),
+		function_type( make_lambda_11_size< 256 >( ) ).share( )
+	};
+
+	for ( auto& fn : functions )
+	{
+		EXPECT_LE( fn.compacted_size( ), 64U );
+
+		alignas( 64 ) unsigned char storage[ 64 ];
+		auto compacted = fn.compact_to( storage );
+
+		EXPECT_FALSE( fn );
+
+		function_type::call_compacted( compacted );
+		function_type::destroy_compacted( compacted, storage );
+	}
+
+	EXPECT_EQ( 4, call_count );
+}
+
+TEST( function, custom_function_size_and_alignment )
+{
+	typedef q::custom_function< void( ), false, 2, 16 > small_function;
+
+	EXPECT_EQ( 16U, alignof( small_function ) );
+	EXPECT_EQ( 8 * sizeof( std::ptrdiff_t ), sizeof( small_function ) );
+
+	call_count = 0;
+
+	int value = 5;
+	small_function fn( [ value ]( ) { call_count += value; } );
+
+	// Trivially relocatable, moved by copying its memory
+	small_function moved( std::move( fn ) );
+	small_function moved_again;
+	moved_again = std::move( moved );
+
+	EXPECT_FALSE( fn );
+	EXPECT_FALSE( moved );
+
+	moved_again( );
+	EXPECT_EQ( 5, call_count );
+}
@@ -0,0 +1,71 @@
+#include <q/function.hpp>
+
+#include <array>
+#include <memory>
+#include <thread>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( function_stats );
+
+namespace {
+
+void plain_function( ) { }
+
+struct non_copyable_function
+{
+	std::unique_ptr< int > ptr_;
+
+	void operator( )( ) const { }
+};
+
+} // anonymous namespace
+
+TEST_F( function_stats, records_storage_and_sizes )
+{
+	q::reset_function_stats( );
+
+	// Nothing is recorded unless enabled
+	q::unique_function< void( ) > unrecorded( [ ]( ) { } );
+
+	auto stats = q::get_function_stats( );
+	EXPECT_EQ( 0U, stats.inlined + stats.unique_ptr + stats.shared_ptr );
+
+	q::set_function_stats_enabled( true );
+
+	q::unique_function< void( ) > inlined( [ ]( ) { } );
+	q::function< void( ) > plain( &plain_function );
+
+	std::array< char, 512 > large_data{ };
+	q::unique_function< void( ) > large( [ large_data ]( ) { } );
+
+	q::function< void( ) > shared( non_copyable_function{ } );
+
+	std::thread( [ ]( )
+	{
+		q::unique_function< void( ) > other_thread( [ ]( ) { } );
+	} ).join( );
+
+	stats = q::get_function_stats( );
+
+	q::set_function_stats_enabled( false );
+
+	EXPECT_EQ( 1U, stats.plain );
+	EXPECT_EQ( 2U, stats.inlined );
+	EXPECT_EQ( 1U, stats.unique_ptr );
+	EXPECT_EQ( 1U, stats.shared_ptr );
+	EXPECT_EQ( 3U, stats.unique_functions );
+	EXPECT_EQ( 2U, stats.shared_functions );
+	EXPECT_EQ( 1U, stats.sizes[ q::function_stats::num_sizes - 1 ] );
+
+	std::size_t total = 0;
+	for ( auto count : stats.sizes )
+		total += count;
+	EXPECT_EQ( 5U, total );
+
+	q::reset_function_stats( );
+
+	stats = q::get_function_stats( );
+	EXPECT_EQ( 0U, stats.inlined );
+	EXPECT_EQ( 0U, stats.shared_functions );
+}
@@ -1,6 +1,10 @@
 
 #include <q/type_traits.hpp>
 
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
 #include "core.hpp"
 
 Q_TEST_MAKE_SCOPE( memory );
@@ -56,3 +60,328 @@ TEST_F( memory, reinterpret_pointer_cast )
 
 	EXPECT_TRUE( done_outer );
 }
+
+TEST_F( memory, pooled_shared_freed_on_other_thread )
+{
+	struct value
+	{
+		value( int i )
+		: i_( i )
+		{ }
+
+		int i_;
+	};
+
+	std::vector< std::shared_ptr< value > > values;
+
+	std::thread thread( [ & ]( )
+	{
+		for ( int i = 0; i < 100; ++i )
+			values.push_back( q::make_pooled_shared< value >( i ) );
+
+		// Reuses the freed block
+		values.pop_back( );
+		values.push_back( q::make_pooled_shared< value >( 99 ) );
+	} );
+	thread.join( );
+
+	// The owning thread has exited, its pool must still be alive
+	for ( int i = 0; i < 100; ++i )
+		EXPECT_EQ( i, values[ i ]->i_ );
+
+	values.clear( );
+
+	auto v = q::make_pooled_shared< value >( 5 );
+	EXPECT_EQ( 5, v->i_ );
+}
+
+namespace {
+
+std::atomic< std::size_t > counted_allocations_( 0 );
+std::atomic< std::size_t > counted_bytes_( 0 );
+
+void* counting_allocate( std::size_t size )
+{
+	++counted_allocations_;
+	counted_bytes_ += size;
+	return ::operator new( size );
+}
+
+void counting_deallocate( void* ptr, std::size_t size )
+{
+	counted_bytes_ -= size;
+	::operator delete( ptr );
+}
+
+std::atomic< std::size_t > tenant_bytes_( 0 );
+
+void* tenant_allocate( std::size_t size )
+{
+	tenant_bytes_ += size;
+	return ::operator new( size );
+}
+
+void tenant_deallocate( void* ptr, std::size_t size )
+{
+	tenant_bytes_ -= size;
+	::operator delete( ptr );
+}
+
+void* capped_allocate( std::size_t )
+{
+	return nullptr;
+}
+
+void capped_deallocate( void* ptr, std::size_t )
+{
+	::operator delete( ptr );
+}
+
+} // anonymous namespace
+
+TEST_F( memory, custom_allocator_functions )
+{
+	counted_allocations_ = 0;
+	counted_bytes_ = 0;
+
+	auto previous = q::get_allocator_functions( );
+
+	q::set_allocator_functions( { &counting_allocate, &counting_deallocate } );
+
+	{
+		std::vector< int, q::allocator< int > > ints( 100, 1 );
+		EXPECT_EQ( 1U, counted_allocations_.load( ) );
+		EXPECT_LE( 100 * sizeof( int ), counted_bytes_.load( ) );
+
+		std::vector< q::task, q::allocator< q::task > > tasks( 2 );
+		EXPECT_EQ( 2U, counted_allocations_.load( ) );
+		EXPECT_EQ(
+			0U,
+			reinterpret_cast< std::uintptr_t >( tasks.data( ) ) %
+				alignof( q::task ) );
+
+		// Freed by the functions which allocated it
+		q::set_allocator_functions( previous );
+	}
+
+	EXPECT_EQ( 0U, counted_bytes_.load( ) );
+}
+
+TEST_F( memory, allocator_functions_cover_shared_objects_and_functions )
+{
+	counted_bytes_ = 0;
+
+	auto previous = q::get_allocator_functions( );
+
+	q::set_allocator_functions( { &counting_allocate, &counting_deallocate } );
+
+	{
+		auto value = q::make_shared< std::string >( "value" );
+		EXPECT_LT( 0U, counted_bytes_.load( ) );
+
+		auto bytes = counted_bytes_.load( );
+
+		char capture[ 256 ] = { 0 };
+		q::function< char( ) > fn( [ capture ]( ) { return capture[ 0 ]; } );
+		EXPECT_LE( bytes + sizeof( capture ), counted_bytes_.load( ) );
+
+		q::set_allocator_functions( previous );
+	}
+
+	EXPECT_EQ( 0U, counted_bytes_.load( ) );
+}
+
+TEST_F( memory, pools_return_empty_chunks )
+{
+	struct value
+	{
+		char data_[ 24 ];
+	};
+
+	counted_allocations_ = 0;
+	counted_bytes_ = 0;
+
+	auto previous = q::get_allocator_functions( );
+
+	q::set_allocator_functions( { &counting_allocate, &counting_deallocate } );
+
+	std::size_t peak_bytes = 0;
+	std::size_t trimmed_bytes = 0;
+
+	// A new thread gets a new pool, with chunks from the counting functions
+	std::thread thread( [ & ]( )
+	{
+		std::vector< std::shared_ptr< value > > values;
+
+		for ( int i = 0; i < 10000; ++i )
+			values.push_back( q::make_pooled_shared< value >( ) );
+
+		peak_bytes = counted_bytes_.load( );
+
+		values.clear( );
+		values.shrink_to_fit( );
+
+		trimmed_bytes = counted_bytes_.load( );
+	} );
+	thread.join( );
+
+	q::set_allocator_functions( previous );
+
+	// Blocks are carved from chunks, not allocated one by one
+	EXPECT_GT( 10000U, counted_allocations_.load( ) );
+
+	// All chunks but one are returned when the blocks are freed
+	EXPECT_LT( 10000 * sizeof( value ), peak_bytes );
+	EXPECT_GT( 16384U, trimmed_bytes );
+
+	// The last chunk is returned when the thread exits
+	EXPECT_EQ( 0U, counted_bytes_.load( ) );
+}
+
+TEST_F( memory, pools_take_back_blocks_freed_by_other_threads )
+{
+	struct value
+	{
+		char data_[ 24 ];
+	};
+
+	counted_bytes_ = 0;
+
+	auto previous = q::get_allocator_functions( );
+
+	q::set_allocator_functions( { &counting_allocate, &counting_deallocate } );
+
+	std::size_t peak_bytes = 0;
+	std::size_t reclaimed_bytes = 0;
+
+	std::thread thread( [ & ]( )
+	{
+		std::vector< std::shared_ptr< value > > values;
+
+		for ( int i = 0; i < 10000; ++i )
+			values.push_back( q::make_pooled_shared< value >( ) );
+
+		peak_bytes = counted_bytes_.load( );
+
+		std::thread( [ & ]( )
+		{
+			values.clear( );
+			values.shrink_to_fit( );
+		} ).join( );
+
+		// The pool has free blocks left, but still takes back the
+		// remotely freed ones after a while
+		for ( int i = 0; i < 100; ++i )
+			q::make_pooled_shared< value >( );
+
+		reclaimed_bytes = counted_bytes_.load( );
+	} );
+	thread.join( );
+
+	q::set_allocator_functions( previous );
+
+	EXPECT_LT( 10000 * sizeof( value ), peak_bytes );
+	EXPECT_GE( 16384U, reclaimed_bytes );
+	EXPECT_EQ( 0U, counted_bytes_.load( ) );
+}
+
+TEST_F( memory, null_allocator_functions_are_rejected )
+{
+	auto previous = q::get_allocator_functions( );
+
+	EXPECT_THROW(
+		q::set_allocator_functions( { nullptr, &counting_deallocate } ),
+		q::invalid_argument );
+	EXPECT_THROW(
+		q::set_allocator_functions( { &counting_allocate, nullptr } ),
+		q::invalid_argument );
+
+	EXPECT_EQ( previous.allocate, q::get_allocator_functions( ).allocate );
+}
+
+TEST( memory_context, allocator_functions_per_execution_context )
+{
+	tenant_bytes_ = 0;
+
+	auto bd = q::make_shared< q::blocking_dispatcher >( "main" );
+	auto s = q::make_shared< q::direct_scheduler >( bd );
+	auto main_ctx = q::make_shared< q::execution_context >( bd, s );
+	auto queue = main_ctx->queue( );
+
+	auto ctx = q::make_execution_context<
+		q::threadpool, q::direct_scheduler
+	>( "tenant", queue, 1 );
+
+	ctx->set_allocator_functions( { &tenant_allocate, &tenant_deallocate } );
+
+	auto kept = std::make_shared< std::shared_ptr< std::string > >( );
+
+	q::with( ctx->queue( ) )
+	.then( [ kept ]( )
+	{
+		*kept = q::make_shared< std::string >( "tenant value" );
+	}, ctx->queue( ) )
+	.then( [ kept, bd, ctx ]( )
+	{
+		EXPECT_LT( 0U, tenant_bytes_.load( ) );
+
+		// Freed outside of the context, by the context's functions
+		kept->reset( );
+
+		bd->terminate( q::termination::linger );
+		ctx->dispatcher( )->terminate( q::termination::linger );
+		ctx->dispatcher( )->await_termination( );
+	}, queue );
+
+	bd->start( );
+	bd->await_termination( );
+}
+
+TEST( memory_context, capped_context_is_charged_for_pooled_blocks )
+{
+	struct value
+	{
+		int i_;
+	};
+
+	auto bd = q::make_shared< q::blocking_dispatcher >( "main" );
+	auto s = q::make_shared< q::direct_scheduler >( bd );
+	auto main_ctx = q::make_shared< q::execution_context >( bd, s );
+	auto queue = main_ctx->queue( );
+
+	auto ctx = q::make_execution_context<
+		q::threadpool, q::direct_scheduler
+	>( "capped", queue, 1 );
+
+	q::with( ctx->queue( ) )
+	.then( [ ]( )
+	{
+		// Leaves an empty chunk of the default functions in the pool of
+		// the context's thread
+		q::make_pooled_shared< value >( );
+	}, ctx->queue( ) )
+	.then( [ ctx ]( )
+	{
+		ctx->set_allocator_functions(
+			{ &capped_allocate, &capped_deallocate } );
+	}, queue )
+	.then( [ ]( )
+	{
+		q::make_pooled_shared< value >( );
+	}, ctx->queue( ) )
+	.then( [ ]( )
+	{
+		ADD_FAILURE( ) << "pooled memory wasn't charged to the context";
+	}, queue )
+	.fail( [ ]( const std::bad_alloc& )
+	{ }, queue )
+	.finally( [ bd, ctx ]( )
+	{
+		bd->terminate( q::termination::linger );
+		ctx->dispatcher( )->terminate( q::termination::linger );
+		ctx->dispatcher( )->await_termination( );
+	}, queue );
+
+	bd->start( );
+	bd->await_termination( );
+}
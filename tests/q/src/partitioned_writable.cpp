@@ -0,0 +1,126 @@
+#include <q/partitioned_writable.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( partitioned_writable );
+
+TEST_F( partitioned_writable, same_key_same_shard_in_order )
+{
+	q::partitioned_writable< std::string, int > pw(
+		queue,
+		[ ]( const std::string& user, const int& ) { return user; },
+		3,
+		10
+	);
+
+	EXPECT_EQ( std::size_t( 3 ), pw.size( ) );
+
+	EXPECT_TRUE( pw.write( "alice", 1 ) );
+	EXPECT_TRUE( pw.write( "bob", 1 ) );
+	EXPECT_TRUE( pw.write( "alice", 2 ) );
+	EXPECT_TRUE( pw.write( "bob", 2 ) );
+	EXPECT_TRUE( pw.write( "alice", 3 ) );
+	pw.close( );
+
+	typedef std::map< std::string, std::vector< int > > received_type;
+
+	auto received = std::make_shared< std::vector< received_type > >( 3 );
+
+	std::vector< q::promise< > > promises;
+	for ( std::size_t i = 0; i < 3; ++i )
+		promises.push_back( pw.get_readable( i ).consume(
+			[ received, i ]( std::string user, int n )
+			{
+				( *received )[ i ][ user ].push_back( n );
+			}
+		) );
+
+	auto promise = q::all( std::move( promises ), queue )
+	.then( [ received ]( )
+	{
+		std::size_t alice_shards = 0;
+		std::size_t bob_shards = 0;
+
+		for ( auto& shard : *received )
+		{
+			if ( shard.count( "alice" ) )
+			{
+				++alice_shards;
+				EXPECT_EQ(
+					std::vector< int >( { 1, 2, 3 } ),
+					shard[ "alice" ] );
+			}
+			if ( shard.count( "bob" ) )
+			{
+				++bob_shards;
+				EXPECT_EQ(
+					std::vector< int >( { 1, 2 } ),
+					shard[ "bob" ] );
+			}
+		}
+
+		EXPECT_EQ( std::size_t( 1 ), alice_shards );
+		EXPECT_EQ( std::size_t( 1 ), bob_shards );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( partitioned_writable, backpressure_when_any_shard_is_full )
+{
+	q::channel< int > ch1( queue, 1, 1 );
+	q::channel< int > ch2( queue, 1, 1 );
+
+	q::partitioned_writable< int > pw(
+		{ ch1.get_writable( ), ch2.get_writable( ) },
+		[ ]( const int& ) { return 0; }
+	);
+
+	auto resumed = std::make_shared< bool >( false );
+	pw.set_resume_notification( [ resumed ]( )
+	{
+		*resumed = true;
+	} );
+
+	EXPECT_TRUE( pw.should_write( ) );
+	EXPECT_TRUE( pw.write( 1 ) );
+	EXPECT_TRUE( pw.write( 2 ) );
+	EXPECT_FALSE( pw.should_write( ) );
+
+	// Both values went to the same shard, which is now full
+	bool first_is_full = !ch1.get_writable( ).should_write( );
+	EXPECT_NE( first_is_full, !ch2.get_writable( ).should_write( ) );
+
+	auto readable = first_is_full
+		? ch1.get_readable( )
+		: ch2.get_readable( );
+
+	auto promise = readable.read( )
+	.then( [ readable ]( int i ) mutable
+	{
+		EXPECT_EQ( 1, i );
+		return readable.read( );
+	} )
+	.then( [ pw, resumed ]( int i )
+	{
+		EXPECT_EQ( 2, i );
+		EXPECT_TRUE( pw.should_write( ) );
+		EXPECT_TRUE( *resumed );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( partitioned_writable, no_shards )
+{
+	auto key = [ ]( const int& i ) { return i; };
+
+	EXPECT_THROW(
+		q::partitioned_writable< int >( queue, key, 0, 10 ),
+		q::invalid_argument );
+
+	EXPECT_THROW(
+		q::partitioned_writable< int >(
+			std::vector< q::writable< int > >( ), key ),
+		q::invalid_argument );
+}
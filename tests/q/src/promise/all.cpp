@@ -1,3 +1,4 @@
+#include <q/channel.hpp>
 
 #include "../core.hpp"
 
@@ -70,3 +71,114 @@ TEST_F( promise_all_test, all_same_voids )
 
 	EXPECT_EQ( iterations * 2, incremented.load( ) );
 }
+
+TEST_F( promise_all_test, all_values_in_order )
+{
+	std::vector< q::promise< int > > promises;
+
+	for ( int i = 0; i < 5; ++i )
+		promises.push_back( q::with( queue, i * 10 ) );
+
+	run(
+		q::all( std::move( promises ), queue )
+		.then( [ ]( std::vector< int > values )
+		{
+			EXPECT_EQ(
+				std::vector< int >( { 0, 10, 20, 30, 40 } ),
+				values );
+		} )
+	);
+}
+
+TEST_F( promise_all_test, all_empty_list )
+{
+	std::vector< q::promise< int, std::string > > promises;
+
+	run(
+		q::all( std::move( promises ), queue )
+		.then( [ ]( std::vector< std::tuple< int, std::string > > values )
+		{
+			EXPECT_TRUE( values.empty( ) );
+		} )
+	);
+}
+
+TEST_F( promise_all_test, all_combines_failures )
+{
+	typedef q::combined_promise_exception< int > exception_type;
+
+	std::vector< q::promise< int > > promises;
+
+	promises.push_back( q::with( queue, 1 ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+	promises.push_back( q::with( queue, 3 ) );
+
+	run(
+		q::all( std::move( promises ), queue )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( std::vector< int > ) { } ) )
+		.fail( [ ]( const exception_type& e )
+		{
+			auto& data = e.data( );
+
+			ASSERT_EQ( std::size_t( 3 ), data.size( ) );
+			EXPECT_EQ( 1, data[ 0 ].get( ) );
+			EXPECT_TRUE( data[ 1 ].has_exception( ) );
+			EXPECT_EQ( 3, data[ 2 ].get( ) );
+			EXPECT_EQ( std::size_t( 1 ), e.exceptions( ).size( ) );
+		} )
+	);
+}
+
+TEST_F( promise_all_test, all_different_values_concatenated )
+{
+	run(
+		q::all(
+			q::with( queue, 1 ),
+			q::with( queue ),
+			q::with( queue, std::string( "two" ), 3.5 ),
+			q::with( queue, 4 ).share( )
+		)
+		.then( [ ]( int a, std::string b, double c, int d )
+		{
+			EXPECT_EQ( 1, a );
+			EXPECT_EQ( "two", b );
+			EXPECT_EQ( 3.5, c );
+			EXPECT_EQ( 4, d );
+		} )
+	);
+}
+
+TEST_F( promise_all_test, all_different_rejects_with_first_failure )
+{
+	Q_MAKE_SIMPLE_EXCEPTION( OtherError );
+
+	run(
+		q::all(
+			q::with( queue, 1 ),
+			q::reject< int >( queue, Error( ) ),
+			q::reject< >( queue, OtherError( ) )
+		)
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int, int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
+
+TEST_F( promise_all_test, all_different_rejects_without_waiting )
+{
+	q::channel< int > ch( queue, 1 );
+
+	auto writable = ch.get_writable( );
+
+	run(
+		q::all(
+			ch.get_readable( ).read( ),
+			q::reject< >( queue, Error( ) )
+		)
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ writable ]( const Error& ) mutable
+		{
+			// The read is still pending, and settles afterwards
+			EXPECT_TRUE( writable.write( 1 ) );
+		} ) )
+	);
+}
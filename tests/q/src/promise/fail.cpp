@@ -214,3 +214,61 @@ TEST_F( fail, exception_ptr_fail_twice_on_promises )
 		} ) )
 	);
 }
+
+TEST_F( fail, merged_error_classes_match_in_order )
+{
+	Q_MAKE_SIMPLE_EXCEPTION( OtherError );
+
+	auto queue = this->queue;
+
+	run(
+		q::with( queue )
+		.then( [ ]( ) -> int
+		{
+			Q_THROW( Error( ) );
+		} )
+		.fail(
+			EXPECT_NO_CALL_WRAPPER( [ ]( const OtherError& ) -> int
+			{
+				return 1;
+			} ),
+			EXPECT_CALL_WRAPPER( [ queue ]( const Error& )
+			{
+				return q::with( queue, 17 );
+			} ),
+			EXPECT_NO_CALL_WRAPPER( [ ]( const std::exception& ) -> int
+			{
+				return 2;
+			} )
+		)
+		.then( EXPECT_CALL_WRAPPER( [ ]( int value )
+		{
+			EXPECT_EQ( 17, value );
+		} ) )
+	);
+}
+
+TEST_F( fail, merged_error_classes_forward_unmatched_and_values )
+{
+	Q_MAKE_SIMPLE_EXCEPTION( OtherError );
+	Q_MAKE_SIMPLE_EXCEPTION( ThirdError );
+
+	run(
+		q::with( queue, 5 )
+		.fail(
+			EXPECT_NO_CALL( int, const OtherError& )( 1 ),
+			EXPECT_NO_CALL( int, const ThirdError& )( 2 )
+		)
+		.then( EXPECT_CALL_WRAPPER( [ ]( int value ) -> int
+		{
+			EXPECT_EQ( 5, value );
+			Q_THROW( Error( ) );
+		} ) )
+		.fail(
+			EXPECT_NO_CALL( int, const OtherError& )( 1 ),
+			EXPECT_NO_CALL( int, const ThirdError& )( 2 )
+		)
+		.then( EXPECT_NO_CALL( void, int )( ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
@@ -0,0 +1,63 @@
+#include "../core.hpp"
+
+Q_TEST_MAKE_SCOPE( lazy );
+
+TEST_F( lazy, fused_chain )
+{
+	auto promise = q::lazy( queue, EXPECT_CALL_WRAPPER(
+	[ ]( )
+	{
+		return 17;
+	} ) )
+	.then( EXPECT_CALL_WRAPPER( [ ]( int value ) -> void
+	{
+		EXPECT_EQ( 17, value );
+	} ) )
+	.then( EXPECT_CALL_WRAPPER( [ ]( )
+	{
+		return std::string( "hello" );
+	} ) )
+	.start( )
+	.then( EXPECT_CALL_WRAPPER( [ ]( std::string&& s )
+	{
+		EXPECT_EQ( "hello", s );
+	} ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( lazy, exception_skips_rest_of_chain )
+{
+	auto promise = q::lazy( queue, [ ]( ) -> int
+	{
+		Q_THROW( Error( ) );
+	} )
+	.then( EXPECT_NO_CALL( int, int )( 0 ) )
+	.start( )
+	.then( EXPECT_NO_CALL( void, int )( ) )
+	.fail( EXPECT_CALL( void, Error& )( ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( lazy, tuple_result_is_unpacked )
+{
+	auto promise = q::lazy( queue, EXPECT_CALL_WRAPPER(
+	[ ]( )
+	{
+		return std::make_tuple( 17, std::string( "hello" ) );
+	} ) )
+	.then( EXPECT_CALL_WRAPPER( [ ]( int value, std::string&& s )
+	{
+		EXPECT_EQ( 17, value );
+		EXPECT_EQ( "hello", s );
+		return std::make_tuple( value + 1 );
+	} ) )
+	.then( EXPECT_CALL_WRAPPER( [ ]( std::tuple< int >&& t )
+	{
+		EXPECT_EQ( 18, std::get< 0 >( t ) );
+	} ) )
+	.start( );
+
+	run( std::move( promise ) );
+}
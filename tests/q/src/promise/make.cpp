@@ -69,6 +69,43 @@ TEST_F( make, async_with_exception )
 	run( std::move( promise ) );
 }
 
+TEST_F( make, async_abandoned )
+{
+	auto promise = q::make_promise( queue,
+		[ ]( q::resolver< int >, q::rejecter< int > )
+		{ }
+	)
+	.then( EXPECT_NO_CALL( void, int )( ) )
+	.fail( EXPECT_CALL( void, q::abandoned_promise_exception& )( ) )
+	.fail( EXPECT_NO_CALL( void, std::exception_ptr )( ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( make, async_abandoned_later )
+{
+	std::shared_ptr< q::resolver< int > > kept_resolver;
+
+	auto promise = q::make_promise( queue,
+		[ &kept_resolver ]( q::resolver< int > resolve, q::rejecter< int > )
+		{
+			kept_resolver = std::make_shared< q::resolver< int > >(
+				std::move( resolve ) );
+		}
+	)
+	.then( EXPECT_NO_CALL( void, int )( ) )
+	.fail( EXPECT_CALL( void, q::abandoned_promise_exception& )( ) )
+	.fail( EXPECT_NO_CALL( void, std::exception_ptr )( ) );
+
+	auto released = q::with( queue )
+	.then( [ &kept_resolver ]( )
+	{
+		kept_resolver.reset( );
+	} );
+
+	run( q::all( std::move( promise ), std::move( released ) ) );
+}
+
 #ifdef LIBQ_WITH_CPP14
 
 TEST_F( make, by_lambda_auto )
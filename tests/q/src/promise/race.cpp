@@ -0,0 +1,159 @@
+#include <q/channel.hpp>
+
+#include "../core.hpp"
+
+Q_TEST_MAKE_SCOPE( promise_race );
+
+TEST_F( promise_race, race_first_settled_wins )
+{
+	q::channel< int > ch( queue, 1 );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( ch.get_readable( ).read( ) );
+	promises.push_back( q::with( queue, 2 ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+
+	auto writable = ch.get_writable( );
+
+	run(
+		q::race( std::move( promises ), queue )
+		.then( [ writable ]( int i ) mutable
+		{
+			EXPECT_EQ( 2, i );
+
+			// The losing read is dropped
+			EXPECT_TRUE( writable.write( 1 ) );
+		} )
+	);
+}
+
+TEST_F( promise_race, race_first_rejected_wins )
+{
+	std::vector< q::promise< > > promises;
+	promises.push_back( q::reject< >( queue, Error( ) ) );
+	promises.push_back( q::with( queue ) );
+
+	run(
+		q::race( std::move( promises ), queue )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
+
+TEST_F( promise_race, any_first_fulfilled_wins )
+{
+	q::channel< int > ch( queue, 1 );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+	promises.push_back( ch.get_readable( ).read( ) );
+	promises.push_back( q::with( queue, 3 ) );
+
+	run(
+		q::any( std::move( promises ), queue )
+		.then( [ ]( int i )
+		{
+			EXPECT_EQ( 3, i );
+		} )
+	);
+}
+
+TEST_F( promise_race, any_rejected_when_all_fail )
+{
+	typedef q::combined_promise_exception< int > exception_type;
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+
+	run(
+		q::any( std::move( promises ), queue )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+		.fail( [ ]( const exception_type& e )
+		{
+			EXPECT_EQ( std::size_t( 2 ), e.exceptions( ).size( ) );
+		} )
+	);
+}
+
+TEST_F( promise_race, some_in_fulfillment_order )
+{
+	q::channel< int > ch( queue, 1 );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( ch.get_readable( ).read( ) );
+	promises.push_back( q::with( queue, 1 ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+	promises.push_back( q::with( queue, 3 ) );
+	promises.push_back( q::with( queue, 4 ) );
+
+	run(
+		q::some( 2, std::move( promises ), queue )
+		.then( [ ]( std::vector< int > values )
+		{
+			EXPECT_EQ( std::vector< int >( { 1, 3 } ), values );
+		} )
+	);
+}
+
+TEST_F( promise_race, some_rejected_when_impossible )
+{
+	typedef q::combined_promise_exception< void > exception_type;
+
+	std::vector< q::promise< > > promises;
+	promises.push_back( q::with( queue ) );
+	promises.push_back( q::reject< >( queue, Error( ) ) );
+	promises.push_back( q::reject< >( queue, Error( ) ) );
+
+	run(
+		q::some( 2, std::move( promises ), queue )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( [ ]( const exception_type& e )
+		{
+			EXPECT_EQ( std::size_t( 2 ), e.exceptions( ).size( ) );
+		} )
+	);
+}
+
+TEST_F( promise_race, some_of_none_ignores_later_settled )
+{
+	auto deferred = q::detail::defer< int >::construct( queue );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( deferred->get_promise( ) );
+	promises.push_back( q::with( queue, 2 ) );
+
+	run(
+		q::some( 0, std::move( promises ), queue )
+		.then( [ deferred ]( std::vector< int > values )
+		{
+			EXPECT_TRUE( values.empty( ) );
+
+			// Dropped, the result is already settled
+			deferred->set_value( 1 );
+		} )
+	);
+}
+
+TEST_F( promise_race, some_of_too_many_ignores_later_settled )
+{
+	typedef q::combined_promise_exception< int > exception_type;
+
+	auto deferred = q::detail::defer< int >::construct( queue );
+
+	std::vector< q::promise< int > > promises;
+	promises.push_back( deferred->get_promise( ) );
+	promises.push_back( q::reject< int >( queue, Error( ) ) );
+
+	run(
+		q::some( 3, std::move( promises ), queue )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( std::vector< int > ) { } ) )
+		.fail( [ deferred ]( const exception_type& e )
+		{
+			EXPECT_TRUE( e.exceptions( ).empty( ) );
+
+			// Dropped, the result is already settled
+			deferred->set_value( 1 );
+		} )
+	);
+}
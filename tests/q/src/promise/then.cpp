@@ -261,3 +261,88 @@ TEST_F( then, tuple_to_promise )
 	);
 }
 
+
+TEST_F( then, shared_const_ref_is_not_copied )
+{
+	auto shared = q::with( queue, std::string( "hello" ) ).share( );
+
+	auto address = [ ]( const std::string& s ) -> const std::string*
+	{
+		EXPECT_EQ( "hello", s );
+		return &s;
+	};
+
+	run(
+		q::all( shared.then( address ), shared.then( address ) )
+		.then( EXPECT_CALL_WRAPPER(
+		[ ]( const std::string* first, const std::string* second )
+		{
+			EXPECT_EQ( first, second );
+		} ) )
+	);
+}
+
+TEST_F( then, shared_fan_out_keeps_order_per_queue )
+{
+	auto deferred = q::detail::defer< int >::construct( queue );
+	auto shared = deferred->get_promise( ).share( );
+
+	std::vector< int > order;
+	std::atomic< int > pool_calls( 0 );
+	std::vector< q::promise< > > promises;
+
+	for ( int i = 0; i < 20; ++i )
+	{
+		promises.push_back( shared.then( [ &order, i ]( int value )
+		{
+			EXPECT_EQ( 5, value );
+			order.push_back( i );
+		} ) );
+
+		promises.push_back( shared.then( [ &pool_calls ]( int )
+		{
+			++pool_calls;
+		}, tp_queue ) );
+	}
+
+	deferred->set_value( 5 );
+
+	run( q::all( promises, queue ).then( [ &order, &pool_calls ]( )
+	{
+		ASSERT_EQ( 20U, order.size( ) );
+		for ( int i = 0; i < 20; ++i )
+			EXPECT_EQ( i, order[ i ] );
+		EXPECT_EQ( 20, pool_calls );
+	} ) );
+}
+
+TEST_F( then, on_settled_keeps_order_with_queued_continuations )
+{
+	auto deferred = q::detail::defer< int >::construct( queue );
+	auto shared = deferred->get_promise( ).share( );
+
+	auto before = q::queue::construct( 0 );
+	auto after = q::queue::construct( 0 );
+
+	bool called = false;
+
+	auto first = shared.then( [ ]( int ) { }, before );
+
+	shared.on_settled(
+		[ &called, before, after ]( q::expect< std::tuple< int > >&& )
+		{
+			called = true;
+			EXPECT_FALSE( before->empty( ) );
+			EXPECT_TRUE( after->empty( ) );
+		} );
+
+	auto last = shared.then( [ ]( int ) { }, after );
+
+	deferred->set_value( 5 );
+
+	EXPECT_TRUE( called );
+	EXPECT_FALSE( after->empty( ) );
+
+	before->pop( ).task_( );
+	after->pop( ).task_( );
+}
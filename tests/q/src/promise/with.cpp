@@ -74,3 +74,17 @@ TEST_F( with, with_char_pointer_to_string )
 		} ) )
 	);
 }
+
+TEST_F( with, with_move_only_value )
+{
+	std::unique_ptr< int > ptr( new int( 5 ) );
+
+	run(
+		q::with( queue, std::move( ptr ) )
+		.then( EXPECT_CALL_WRAPPER(
+		[ ]( std::unique_ptr< int >&& ptr )
+		{
+			EXPECT_EQ( 5, *ptr );
+		} ) )
+	);
+}
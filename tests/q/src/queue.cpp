@@ -0,0 +1,138 @@
+
+#include <q/queue.hpp>
+#include <q/event_dispatcher.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+#include "core.hpp"
+
+namespace {
+
+class counting_dispatcher
+: public q::basic_event_dispatcher
+{
+public:
+	counting_dispatcher( )
+	: notifications_( 0 )
+	{ }
+
+	void notify( ) override
+	{
+		++notifications_;
+	}
+
+	void set_task_fetcher( q::task_fetcher_task&& ) override { }
+	void set_unloader( q::task ) override { }
+
+	std::size_t parallelism( ) const override
+	{
+		return 2;
+	}
+
+	std::atomic< int > notifications_;
+};
+
+/**
+ * An over-aligned function object, which counts the times it has been
+ * constructed at a misaligned address, e.g. when moved into a queue.
+ */
+struct alignas( 32 ) aligned_task
+{
+	aligned_task( int& misaligned, int& calls )
+	: misaligned_( &misaligned )
+	, calls_( &calls )
+	{
+		check( );
+	}
+
+	aligned_task( aligned_task&& other )
+	: misaligned_( other.misaligned_ )
+	, calls_( other.calls_ )
+	{
+		check( );
+	}
+
+	aligned_task( const aligned_task& other )
+	: misaligned_( other.misaligned_ )
+	, calls_( other.calls_ )
+	{
+		check( );
+	}
+
+	void operator( )( ) const
+	{
+		check( );
+		++*calls_;
+	}
+
+	void check( ) const
+	{
+		if ( reinterpret_cast< std::uintptr_t >( this ) % 32 != 0 )
+			++*misaligned_;
+	}
+
+	int* misaligned_;
+	int* calls_;
+};
+
+} // anonymous namespace
+
+TEST( queue, over_aligned_tasks )
+{
+	auto tasks = q::queue::construct( 0 );
+
+	int misaligned = 0;
+	int calls = 0;
+	int small_calls = 0;
+
+	// Small tasks in between shift the records off the 32 byte boundary
+	for ( int i = 0; i < 200; ++i )
+	{
+		tasks->push( aligned_task( misaligned, calls ) );
+		tasks->push( [ &small_calls ]( ) { ++small_calls; } );
+	}
+
+	while ( !tasks->empty( ) )
+		tasks->pop( ).task_( );
+
+	EXPECT_EQ( 200, calls );
+	EXPECT_EQ( 200, small_calls );
+	EXPECT_EQ( 0, misaligned );
+}
+
+TEST( queue, dispatcher_consumer )
+{
+	counting_dispatcher dispatcher;
+	auto queue = q::queue::construct( 0 );
+
+	queue->set_consumer( &dispatcher );
+	EXPECT_EQ( 2U, queue->parallelism( ) );
+
+	queue->push( [ ]( ) { } );
+	EXPECT_EQ( 1, dispatcher.notifications_ );
+
+	// Notified at most as many times as the parallelism
+	q::task tasks[ 3 ] = { [ ]( ) { }, [ ]( ) { }, [ ]( ) { } };
+	queue->push_batch( tasks, 3 );
+	EXPECT_EQ( 3, dispatcher.notifications_ );
+
+	queue->remove_consumer( );
+
+	queue->push( [ ]( ) { } );
+	EXPECT_EQ( 3, dispatcher.notifications_ );
+	EXPECT_EQ( 5U, queue->accounting( ).tasks.count );
+}
+
+TEST( queue, function_consumer_batch )
+{
+	auto queue = q::queue::construct( 0 );
+
+	int notifications = 0;
+	queue->set_consumer( [ &notifications ]( ) { ++notifications; }, 2 );
+
+	// Notified once per task, regardless of the parallelism
+	q::task tasks[ 3 ] = { [ ]( ) { }, [ ]( ) { }, [ ]( ) { } };
+	queue->push_batch( tasks, 3 );
+	EXPECT_EQ( 3, notifications );
+}
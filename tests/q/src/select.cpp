@@ -0,0 +1,212 @@
+#include <q/select.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( select );
+
+Q_MAKE_SIMPLE_EXCEPTION( test_exception );
+
+TEST_F( select, empty_selector )
+{
+	q::selector sel( queue );
+
+	auto promise = sel.select( )
+	.then( EXPECT_CALL_WRAPPER(
+		[ ]( bool got_data )
+		{
+			EXPECT_FALSE( got_data );
+		}
+	) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( select, first_available )
+{
+	q::channel< int > ch1( queue, 5 );
+	q::channel< std::string > ch2( queue, 5 );
+
+	auto w2 = ch2.get_writable( );
+	EXPECT_TRUE( w2.write( "hello" ) );
+
+	q::selector sel( queue );
+	sel
+	.add( ch1.get_readable( ), EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+	.add( ch2.get_readable( ), EXPECT_CALL_WRAPPER(
+		[ ]( std::string s )
+		{
+			EXPECT_EQ( "hello", s );
+		}
+	) );
+
+	auto promise = sel.select( )
+	.then( EXPECT_CALL_WRAPPER(
+		[ ]( bool got_data )
+		{
+			EXPECT_TRUE( got_data );
+		}
+	) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( select, does_not_consume_more_than_one )
+{
+	q::channel< int > ch1( queue, 5 );
+	q::channel< int > ch2( queue, 5 );
+
+	auto w1 = ch1.get_writable( );
+	auto w2 = ch2.get_writable( );
+
+	auto received = std::make_shared< std::vector< int > >( );
+
+	q::selector sel( queue );
+	sel
+	.add( ch1.get_readable( ), [ received ]( int i )
+	{
+		received->push_back( i );
+	} )
+	.add( ch2.get_readable( ), [ received ]( int i )
+	{
+		received->push_back( i );
+	} );
+
+	auto promise = sel.select( )
+	.then( [ received ]( bool got_data )
+	{
+		EXPECT_TRUE( got_data );
+		EXPECT_EQ( std::size_t( 1 ), received->size( ) );
+	} );
+
+	// Both readables have waiters, but only one of them may take a value
+	EXPECT_TRUE( w1.write( 1 ) );
+	EXPECT_TRUE( w2.write( 2 ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( select, merge_consume )
+{
+	q::channel< int > ch1( queue, 10 );
+	q::channel< int > ch2( queue, 10 );
+
+	auto w1 = ch1.get_writable( );
+	auto w2 = ch2.get_writable( );
+
+	auto received = std::make_shared< std::vector< int > >( );
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		EXPECT_TRUE( w1.write( i ) );
+		EXPECT_TRUE( w2.write( 10 + i ) );
+	}
+	w1.close( );
+	w2.close( );
+
+	auto promise = q::merge_readables(
+		[ received ]( int i ) { received->push_back( i ); },
+		ch1.get_readable( ),
+		ch2.get_readable( )
+	)
+	.consume( )
+	.then( EXPECT_CALL_WRAPPER(
+		[ received ]( )
+		{
+			// Round-robin between the readables
+			ASSERT_EQ( std::size_t( 6 ), received->size( ) );
+			EXPECT_EQ( 0, ( *received )[ 0 ] );
+			EXPECT_EQ( 10, ( *received )[ 1 ] );
+			EXPECT_EQ( 1, ( *received )[ 2 ] );
+			EXPECT_EQ( 11, ( *received )[ 3 ] );
+			EXPECT_EQ( 2, ( *received )[ 4 ] );
+			EXPECT_EQ( 12, ( *received )[ 5 ] );
+		}
+	) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( select, exception_rejects )
+{
+	q::channel< int > ch1( queue, 5 );
+	q::channel< int > ch2( queue, 5 );
+
+	ch1.get_writable( ).close( test_exception( ) );
+
+	auto promise = q::merge_readables(
+		EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ),
+		ch1.get_readable( ),
+		ch2.get_readable( )
+	)
+	.consume( )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER( [ ]( test_exception& ) { } ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( select, abandoned_waiter_dropped_while_writing )
+{
+	q::channel< int > ch1( queue, 5 );
+	q::channel< int > ch2( queue, 5 );
+
+	auto r1 = ch1.get_readable( );
+	auto w1 = ch1.get_writable( );
+	auto w2 = ch2.get_writable( );
+
+	// The handler of ch1 holds the only reference to an unsettled defer
+	auto deferred = q::make_shared< q::detail::defer< > >( queue );
+	auto abandoned = deferred->get_promise( );
+
+	auto settled = std::make_shared< bool >( false );
+
+	// Writing to ch1 from a synchronous callback deadlocks if it's called
+	// while ch1 is locked
+	abandoned.on_settled( [ w1, settled ]( q::expect< std::tuple< > >&& exp )
+	mutable
+	{
+		EXPECT_TRUE( exp.has_exception( ) );
+		*settled = true;
+		q::ignore_result( w1.write( 2 ) );
+	} );
+
+	// The selector is destroyed, leaving the reference to the waiter
+	auto selected = [ & ]( )
+	{
+		q::selector sel( queue );
+		sel
+		.add( r1, [ deferred ]( int ) { } )
+		.add( ch2.get_readable( ), [ ]( int ) { } );
+
+		return sel.select( );
+	}( );
+
+	deferred.reset( );
+
+	auto promise = std::move( selected )
+	.then( [ w1, settled ]( bool ) mutable
+	{
+		// ch1's waiter was abandoned when ch2 got a value. It is
+		// dropped by this write, with ch1 locked.
+		EXPECT_TRUE( w1.write( 1 ) );
+		EXPECT_FALSE( *settled );
+	} )
+	.then( [ r1 ]( ) mutable
+	{
+		return r1.read( );
+	} )
+	.then( [ r1 ]( int value ) mutable
+	{
+		EXPECT_EQ( 1, value );
+		return r1.read( );
+	} )
+	.then( [ settled ]( int value )
+	{
+		EXPECT_TRUE( *settled );
+		EXPECT_EQ( 2, value );
+	} );
+
+	EXPECT_TRUE( w2.write( 1 ) );
+
+	run( std::move( promise ) );
+}
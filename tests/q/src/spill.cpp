@@ -0,0 +1,173 @@
+#include <q/spill.hpp>
+
+#include "core.hpp"
+
+#include <fstream>
+
+Q_TEST_MAKE_SCOPE( spill );
+
+TEST_F( spill, file_keeps_order_and_restarts_when_drained )
+{
+	q::spill_file file( "q-unit-tests-spill-file.tmp" );
+
+	std::string record;
+
+	EXPECT_TRUE( file.empty( ) );
+	EXPECT_FALSE( file.read( record ) );
+
+	file.append( "first" );
+	file.append( "" );
+	file.append( "third" );
+	EXPECT_EQ( std::size_t( 3 ), file.size( ) );
+
+	EXPECT_TRUE( file.read( record ) );
+	EXPECT_EQ( "first", record );
+	EXPECT_TRUE( file.read( record ) );
+	EXPECT_EQ( "", record );
+
+	file.append( "fourth" );
+
+	EXPECT_TRUE( file.read( record ) );
+	EXPECT_EQ( "third", record );
+	EXPECT_TRUE( file.read( record ) );
+	EXPECT_EQ( "fourth", record );
+
+	EXPECT_TRUE( file.empty( ) );
+	EXPECT_FALSE( file.read( record ) );
+
+	file.append( "again" );
+	EXPECT_TRUE( file.read( record ) );
+	EXPECT_EQ( "again", record );
+}
+
+TEST_F( spill, file_is_compacted_when_never_drained )
+{
+	const std::string path = "q-unit-tests-spill-compact.tmp";
+
+	auto file_size = [ &path ]( )
+	{
+		std::ifstream f( path, std::ios::binary | std::ios::ate );
+		return static_cast< std::size_t >( f.tellg( ) );
+	};
+
+	q::spill_file file( path, 256 );
+
+	const std::string payload( 32, 'x' );
+	std::string record;
+
+	// Keeps a backlog of a few records while many more pass through, so
+	// the file is never fully read
+	int appended = 0;
+	int read = 0;
+
+	for ( ; appended < 4; ++appended )
+		file.append( std::to_string( appended ) + payload );
+
+	for ( int i = 0; i < 200; ++i )
+	{
+		file.append( std::to_string( appended++ ) + payload );
+
+		EXPECT_TRUE( file.read( record ) );
+		EXPECT_EQ( std::to_string( read++ ) + payload, record );
+
+		EXPECT_GT( std::size_t( 1024 ), file_size( ) );
+	}
+
+	EXPECT_EQ( std::size_t( 4 ), file.size( ) );
+
+	while ( file.read( record ) )
+		EXPECT_EQ( std::to_string( read++ ) + payload, record );
+
+	EXPECT_EQ( appended, read );
+}
+
+TEST_F( spill, overflow_is_spilled_and_replayed_in_order )
+{
+	q::channel< int, std::string > ch( queue, 2 );
+
+	typedef std::tuple< int, std::string > tuple_type;
+
+	q::spilling_writable< int, std::string > writable(
+		ch.get_writable( ),
+		"q-unit-tests-spilling-writable.tmp",
+		[ ]( const int& i, const std::string& s )
+		{
+			return std::to_string( i ) + ":" + s;
+		},
+		[ ]( const std::string& record )
+		{
+			auto colon = record.find( ':' );
+			return tuple_type(
+				std::stoi( record.substr( 0, colon ) ),
+				record.substr( colon + 1 ) );
+		}
+	);
+
+	for ( int i = 0; i < 20; ++i )
+		EXPECT_TRUE( writable.write( i, std::to_string( i * 2 ) ) );
+
+	EXPECT_GT( writable.spilled( ), std::size_t( 0 ) );
+
+	writable.close( );
+
+	auto next = std::make_shared< int >( 0 );
+
+	auto promise = ch.get_readable( ).consume(
+		[ next ]( int i, std::string s )
+		{
+			EXPECT_EQ( *next, i );
+			EXPECT_EQ( std::to_string( i * 2 ), s );
+			++*next;
+		}
+	)
+	.then( [ next, writable ]( )
+	{
+		EXPECT_EQ( 20, *next );
+		EXPECT_EQ( std::size_t( 0 ), writable.spilled( ) );
+	} );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( spill, failing_deserializer_closes_channel )
+{
+	q::channel< int > ch( queue, 2 );
+
+	q::spilling_writable< int > writable(
+		ch.get_writable( ),
+		"q-unit-tests-spilling-writable-failing.tmp",
+		[ ]( const int& i )
+		{
+			return std::to_string( i );
+		},
+		[ ]( const std::string& record ) -> std::tuple< int >
+		{
+			if ( record == "5" )
+				Q_THROW( q::runtime_error( "bad record" ) );
+			return std::tuple< int >( std::stoi( record ) );
+		}
+	);
+
+	for ( int i = 0; i < 10; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+
+	writable.close( );
+
+	auto next = std::make_shared< int >( 0 );
+
+	auto promise = ch.get_readable( ).consume( [ next ]( int i )
+	{
+		EXPECT_EQ( *next, i );
+		++*next;
+	} )
+	.then( [ ]( )
+	{
+		ADD_FAILURE( ) << "consume should fail";
+	} )
+	.fail( [ next ]( const q::runtime_error& )
+	{
+		EXPECT_EQ( 5, *next );
+	} );
+
+	run( std::move( promise ) );
+}
@@ -6,6 +6,7 @@
 #include <q/threadpool.hpp>
 #include <q/promise.hpp>
 
+#include <future>
 #include <queue>
 
 TEST( thread_pool, perform_tasks )
@@ -55,3 +56,90 @@ TEST( thread_pool, perform_tasks )
 	tp->await_termination( );
 	bd->dispatcher( )->await_termination( );
 }
+
+Q_TEST_MAKE_SCOPE( thread_pool_worker );
+
+TEST_F( thread_pool_worker, current_event_dispatcher )
+{
+	q::basic_event_dispatcher* pool = tp.get( );
+	q::basic_event_dispatcher* blocking = bd.get( );
+
+	EXPECT_EQ( nullptr, q::current_event_dispatcher( ) );
+
+	run(
+		q::with( tp_queue )
+		.then( [ pool ]( )
+		{
+			EXPECT_EQ( pool, q::current_event_dispatcher( ) );
+		}, tp_queue )
+		.then( [ blocking ]( )
+		{
+			EXPECT_EQ( blocking, q::current_event_dispatcher( ) );
+		}, queue )
+	);
+}
+
+TEST_F( thread_pool_worker, affinity_runs_continuations_on_same_thread )
+{
+	tp->set_worker_affinity( true );
+
+	auto ids = std::make_shared< std::vector< std::thread::id > >( );
+
+	auto record = [ ids ]( )
+	{
+		ids->push_back( std::this_thread::get_id( ) );
+	};
+
+	auto tp_queue = this->tp_queue;
+
+	// The chain is built by a worker, so that all continuations are
+	// pushed by workers of the pool
+	run(
+		q::with( tp_queue )
+		.then( [ tp_queue, record ]( )
+		{
+			auto promise = q::with( tp_queue ).then( record, tp_queue );
+
+			for ( std::size_t i = 0; i < 10; ++i )
+				promise = promise.then( record, tp_queue );
+
+			return promise;
+		}, tp_queue )
+		.then( [ ids ]( )
+		{
+			ASSERT_EQ( 11U, ids->size( ) );
+
+			for ( auto& id : *ids )
+				EXPECT_TRUE( ids->front( ) == id );
+		}, queue )
+	);
+}
+
+TEST_F( thread_pool_worker, affinity_parked_task_is_stolen )
+{
+	tp->set_worker_affinity( true );
+
+	auto tp_queue = this->tp_queue;
+	auto stolen = std::make_shared< std::promise< std::thread::id > >( );
+
+	// The continuation is parked by a worker which then stays busy, so
+	// the other worker must take it
+	run(
+		q::with( tp_queue )
+		.then( [ tp_queue, stolen ]( )
+		{
+			q::with( tp_queue ).then( [ stolen ]( )
+			{
+				stolen->set_value( std::this_thread::get_id( ) );
+			}, tp_queue );
+
+			auto future = stolen->get_future( );
+			auto status = future.wait_for( std::chrono::seconds( 10 ) );
+
+			ASSERT_EQ( std::future_status::ready, status );
+
+			auto self = std::this_thread::get_id( );
+			EXPECT_FALSE( future.get( ) == self );
+		}, tp_queue )
+	);
+}